@@ -0,0 +1,431 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <filesystem>
+#include <memory>
+#include <numbers>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <GLUtil.h>
+#include <Game.h>
+#include <Simd.h>
+#include <benchmark/benchmark.h>
+#include <box2d/box2d.h>
+
+// One hidden window, shared by every benchmark that needs an OpenGL context. It is only
+// opened by the first one that runs.
+static GLFWwindow* sWindow = nullptr;
+
+static GLFWwindow* glContext()
+{
+  static bool sTried = false;
+  if (!sTried) {
+    sTried = true;
+    if (view::initGL(sWindow, false)) {
+      sWindow = nullptr;
+    }
+  }
+  return sWindow;
+}
+
+// Every square and every ball is live, which is the worst case for the draw.
+static std::array<Vertex, Arena::NGrid + Arena::NMaxBalls> fullBoard()
+{
+  std::array<Vertex, Arena::NGrid + Arena::NMaxBalls> vertices;
+  for (uint32_t i = 0; i < vertices.size(); ++i) {
+    Object obj(i < Arena::NGrid ? SQUARE : BALL);
+    obj.mData = int(i + 1);
+    vertices[i].setAttributes(obj);
+    vertices[i].mPos = i < Arena::NGrid
+                         ? Arena::CellSize * glm::vec2 {float(i % Arena::NX) + 0.5f,
+                                                        float(i / Arena::NX) + 0.5f}
+                         : glm::vec2 {std::fmod(float(i) * 37.f, Arena::Width),
+                                      std::fmod(float(i) * 53.f, Arena::Height)};
+  }
+  return vertices;
+}
+
+static void ArenaConstruction(benchmark::State& state)
+{
+  for (auto _ : state) {
+    b2World world(b2Vec2(0.f, 0.f));
+    Arena   arena(world);
+    benchmark::DoNotOptimize(arena);
+  }
+}
+BENCHMARK(ArenaConstruction);
+
+static void ArenaAdvance(benchmark::State& state)
+{
+  b2World world(b2Vec2(0.f, 0.f));
+  Arena   arena(world);
+  auto    fresh = std::make_unique<Arena::Snapshot>();
+  arena.snapshot(*fresh);
+  uint32_t seed = 0;
+  for (auto _ : state) {
+    // The rows reach the bottom every few dozen turns.
+    if (arena.advance(seed++)) {
+      state.PauseTiming();
+      arena.restore(*fresh);
+      state.ResumeTiming();
+    }
+  }
+}
+BENCHMARK(ArenaAdvance);
+
+// A whole turn with the given number of balls, launched one after the other from a board
+// a few rows into the game, until the last one lands.
+static void Turn(benchmark::State& state)
+{
+  StepConfig config;
+  config.mPhysics = Physics(state.range(1));
+  Simulation sim(config);
+  Arena&     arena = sim.arena();
+  for (uint32_t turn = 0; turn < 4; ++turn) {
+    arena.advance(turn);
+  }
+  auto snap = std::make_unique<Arena::Snapshot>();
+  arena.snapshot(*snap);
+  snap->mNumBalls = uint32_t(state.range(0));
+  for (uint32_t i = 0; i < snap->mNumBalls; ++i) {
+    snap->mBalls[i] = {arena.launchPoint(), {0.f, 0.f}};
+  }
+  const float angle = 0.3f * std::numbers::pi_v<float>;
+  for (auto _ : state) {
+    state.PauseTiming();
+    arena.restore(*snap);
+    state.ResumeTiming();
+    sim.playShot(angle);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(Turn)
+  ->ArgNames({"balls", "physics"})
+  ->ArgsProduct({{1, 64, 512, Arena::NMaxBalls},
+                 {int64_t(Physics::Box2D), int64_t(Physics::Grid)}})
+  ->Unit(benchmark::kMillisecond);
+
+// Every ball fanned out over the whole range of angles at once, from a board a few turns
+// into the game, flying until it lands. Both backends play the same shot.
+static void FannedShot(benchmark::State& state)
+{
+  StepConfig config;
+  config.mPhysics = Physics(state.range(0));
+  Simulation sim(config);
+  Arena&     arena = sim.arena();
+  for (uint32_t turn = 0; turn < 4; ++turn) {
+    arena.advance(turn);
+  }
+  auto snap = std::make_unique<Arena::Snapshot>();
+  arena.snapshot(*snap);
+  const float range = std::numbers::pi_v<float> - 2.f * Arena::MinAngle;
+  for (uint32_t i = 0; i < Arena::NMaxBalls; ++i) {
+    float a         = Arena::MinAngle + range * (float(i) + 0.5f) / Arena::NMaxBalls;
+    snap->mBalls[i] = {arena.launchPoint(),
+                       Arena::BallSpeed * glm::vec2 {std::cos(a), std::sin(a)}};
+  }
+  snap->mNumBalls    = Arena::NMaxBalls;
+  snap->mNumLaunched = Arena::NMaxBalls;
+  snap->mInPlay      = true;
+  auto before        = arena.board();
+  for (auto _ : state) {
+    state.PauseTiming();
+    arena.restore(*snap);
+    state.ResumeTiming();
+    sim.playShot(0.f);
+  }
+  // Every iteration plays the same shot, so the last board tells how it went.
+  auto     after  = arena.board();
+  uint32_t broken = 0;
+  for (uint32_t i = 0; i < Arena::NGrid; ++i) {
+    Vertex b, a;
+    b.mPacked = before[i];
+    a.mPacked = after[i];
+    broken += b.type() == SQUARE && a.type() != SQUARE;
+  }
+  state.counters["broken"] = double(broken);
+  state.SetItemsProcessed(state.iterations() * Arena::NMaxBalls);
+}
+BENCHMARK(FannedShot)
+  ->ArgName("physics")
+  ->Arg(int64_t(Physics::Box2D))
+  ->Arg(int64_t(Physics::Grid))
+  ->Unit(benchmark::kMillisecond);
+
+// Carrying every ball from the bodies to the vertices, as after a step for a frame. The
+// naive loop chases every body pointer and blends it into its vertex one ball at a time.
+// The batched loops gather the bodies into arrays once, then blend them all with one
+// kernel.
+class BallSync : public benchmark::Fixture
+{
+public:
+  static constexpr uint32_t N = Arena::NMaxBalls;
+
+  void SetUp(const benchmark::State&) override
+  {
+    mWorld = std::make_unique<b2World>(b2Vec2(0.f, 0.f));
+    mBodies.resize(N);
+    for (uint32_t i = 0; i < N; ++i) {
+      b2BodyDef def;
+      def.type = b2_dynamicBody;
+      def.position.Set(std::fmod(float(i) * 37.f, Arena::Width),
+                       std::fmod(float(i) * 53.f, Arena::Height));
+      mBodies[i] = mWorld->CreateBody(&def);
+    }
+    mVertices.assign(N, Vertex {});
+    mPrev.assign(N, glm::vec2 {0.f, 0.f});
+    for (auto& v : mSoa) {
+      v.assign(N, 0.f);
+    }
+  }
+
+  void TearDown(const benchmark::State&) override
+  {
+    mBodies.clear();
+    mWorld.reset();
+  }
+
+protected:
+  // Alternates between two blend factors, like frames between steps.
+  static float alpha(uint32_t round) { return 0.5f + 0.5f * float(round % 2); }
+
+  template<typename F>
+  void batched(benchmark::State& state, F&& blend)
+  {
+    uint32_t round = 0;
+    for (auto _ : state) {
+      for (uint32_t i = 0; i < N; ++i) {
+        const b2Vec2& p = mBodies[i]->GetPosition();
+        mSoa[2][i]      = p.x;
+        mSoa[3][i]      = p.y;
+      }
+      blend(mSoa[0].data(),
+            mSoa[1].data(),
+            mSoa[2].data(),
+            mSoa[3].data(),
+            alpha(round++),
+            mVertices.data(),
+            size_t(N));
+      std::swap(mSoa[0], mSoa[2]);
+      std::swap(mSoa[1], mSoa[3]);
+    }
+    state.SetItemsProcessed(state.iterations() * N);
+  }
+
+  std::unique_ptr<b2World>          mWorld;
+  std::vector<b2Body*>              mBodies;
+  std::vector<Vertex>               mVertices;
+  std::vector<glm::vec2>            mPrev;
+  std::array<std::vector<float>, 4> mSoa;  // Previous and current x and y.
+};
+
+BENCHMARK_F(BallSync, Naive)(benchmark::State& state)
+{
+  uint32_t round = 0;
+  for (auto _ : state) {
+    const float a = alpha(round++);
+    for (uint32_t i = 0; i < N; ++i) {
+      const b2Vec2& p   = mBodies[i]->GetPosition();
+      glm::vec2     cur = {p.x, p.y};
+      mVertices[i].mPos = mPrev[i] + a * (cur - mPrev[i]);
+      mPrev[i]          = cur;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * N);
+}
+
+BENCHMARK_F(BallSync, Scalar)(benchmark::State& state)
+{
+  batched(state, simd::blendPositionsScalar);
+}
+
+BENCHMARK_F(BallSync, Dispatched)(benchmark::State& state)
+{
+  state.SetLabel(std::string(simd::isaName(simd::isa())));
+  batched(state, simd::blendPositions);
+}
+
+// The broad phase of the grid physics over a full set of balls spread over a board with
+// every other cell occupied. Steps go forth and back, so the balls that move stay where
+// they were.
+class BroadPhase : public benchmark::Fixture
+{
+public:
+  static constexpr uint32_t N = Arena::NMaxBalls;
+
+  void SetUp(const benchmark::State&) override
+  {
+    for (uint32_t i = 0; i < N; ++i) {
+      float a  = float(i) * 0.61f;
+      mPosX[i] = std::fmod(float(i) * 37.f, Arena::Width);
+      mPosY[i] = std::fmod(float(i) * 53.f, Arena::Height);
+      mVelX[i] = Arena::BallSpeed * std::cos(a);
+      mVelY[i] = Arena::BallSpeed * std::sin(a);
+    }
+  }
+
+protected:
+  static constexpr uint64_t Cells = 0x5555555555555555ull;
+  static constexpr float    Dt    = 1.f / 120.f;
+
+  template<typename F>
+  void run(benchmark::State& state, F&& move)
+  {
+    uint32_t round = 0;
+    for (auto _ : state) {
+      move(mPosX.data(),
+           mPosY.data(),
+           mVelX.data(),
+           mVelY.data(),
+           round++ % 2 ? -Dt : Dt,
+           Cells,
+           mNear.data(),
+           size_t(N));
+    }
+    state.SetItemsProcessed(state.iterations() * N);
+  }
+
+  alignas(32) std::array<float, N> mPosX;
+  alignas(32) std::array<float, N> mPosY;
+  alignas(32) std::array<float, N> mVelX;
+  alignas(32) std::array<float, N> mVelY;
+  std::array<uint8_t, N>           mNear;
+};
+
+BENCHMARK_F(BroadPhase, Scalar)(benchmark::State& state)
+{
+  run(state, simd::moveClearBallsScalar);
+}
+
+BENCHMARK_F(BroadPhase, Dispatched)(benchmark::State& state)
+{
+  state.SetLabel(std::string(simd::isaName(simd::isa())));
+  run(state, simd::moveClearBalls);
+}
+
+static void VboUpload(benchmark::State& state)
+{
+  if (!glContext()) {
+    state.SkipWithError("No OpenGL context.");
+    return;
+  }
+  auto         vertices = fullBoard();
+  view::GLSink sink(view::Pipeline(state.range(0)));
+  for (auto _ : state) {
+    sink.upload(0, vertices);
+    // Wait for the driver to actually move the data.
+    glFinish();
+  }
+  state.SetBytesProcessed(state.iterations() * sizeof(vertices));
+}
+BENCHMARK(VboUpload)
+  ->ArgName("pipeline")
+  ->Arg(int64_t(view::Pipeline::Geometry))
+  ->Arg(int64_t(view::Pipeline::Instanced));
+
+// A whole frame of the full board, balls streamed in, drawn into the window at the
+// render scale, in percent.
+static void Frame(benchmark::State& state)
+{
+  if (!glContext()) {
+    state.SkipWithError("No OpenGL context.");
+    return;
+  }
+  auto         vertices = fullBoard();
+  auto         balls    = std::span<const Vertex>(vertices).subspan(Arena::NGrid);
+  view::Screen screen(sWindow, float(state.range(1)) / 100.f);
+  view::GLSink sink(view::Pipeline(state.range(0)));
+  sink.upload(0, vertices);
+  for (auto _ : state) {
+    if (std::span<Vertex> stream = sink.streamBalls(); !stream.empty()) {
+      std::copy(balls.begin(), balls.end(), stream.begin());
+    }
+    screen.begin();
+    sink.draw(Arena::NGrid, Arena::NMaxBalls);
+    screen.end();
+    glFinish();
+  }
+}
+BENCHMARK(Frame)
+  ->ArgNames({"pipeline", "scale"})
+  ->ArgsProduct({{int64_t(view::Pipeline::Geometry), int64_t(view::Pipeline::Instanced)},
+                 {50, 100}})
+  ->Unit(benchmark::kMillisecond);
+
+static void ShaderCompilation(benchmark::State& state)
+{
+  if (!glContext()) {
+    state.SkipWithError("No OpenGL context.");
+    return;
+  }
+  // Without the cache, every iteration compiles and links from source. With it, the
+  // first program is compiled before timing, and every iteration loads its binary.
+  auto dir = state.range(1) ? std::filesystem::temp_directory_path() / "cabbage-bench"
+                            : std::filesystem::path();
+  view::setShaderCacheDir(dir);
+  if (state.range(1)) {
+    view::Shader warm(view::Pipeline(state.range(0)));
+  }
+  for (auto _ : state) {
+    view::Shader shader(view::Pipeline(state.range(0)));
+    // Some drivers defer the link until the program is first used.
+    shader.use();
+    glFinish();
+  }
+  if (state.range(1)) {
+    std::error_code err;
+    std::filesystem::remove_all(dir, err);
+  }
+}
+BENCHMARK(ShaderCompilation)
+  ->ArgNames({"pipeline", "cached"})
+  ->ArgsProduct({{int64_t(view::Pipeline::Geometry), int64_t(view::Pipeline::Instanced)},
+                 {0, 1}})
+  ->Unit(benchmark::kMillisecond);
+
+static void CharAtlasConstruction(benchmark::State& state)
+{
+  if (!glContext()) {
+    state.SkipWithError("No OpenGL context.");
+    return;
+  }
+  for (auto _ : state) {
+    view::CharAtlas atlas(view::Font(state.range(0)));
+    benchmark::DoNotOptimize(atlas);
+  }
+}
+BENCHMARK(CharAtlasConstruction)
+  ->ArgName("font")
+  ->Arg(int64_t(view::Font::Bitmap))
+  ->Arg(int64_t(view::Font::Sdf))
+  ->Unit(benchmark::kMillisecond);
+
+int main(int argc, char** argv)
+{
+  // The results are also written to a JSON file, unless told otherwise, so runs from
+  // different builds can be compared with benchmark's compare.py.
+  std::string        out    = "--benchmark_out=cabbage_bench.json";
+  std::string        format = "--benchmark_out_format=json";
+  std::vector<char*> args(argv, argv + argc);
+  if (std::none_of(args.begin() + 1, args.end(), [](const char* arg) {
+        return std::string_view(arg).starts_with("--benchmark_out=");
+      })) {
+    args.push_back(out.data());
+    args.push_back(format.data());
+  }
+  int nArgs = int(args.size());
+  benchmark::Initialize(&nArgs, args.data());
+  if (benchmark::ReportUnrecognizedArguments(nArgs, args.data())) {
+    return 1;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  if (sWindow) {
+    glfwDestroyWindow(sWindow);
+    glfwTerminate();
+  }
+  return 0;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+#include <array>
+
+#include <Game.h>
+
+// Geometry of the grid in arena coordinates, computed at compile time from the constants
+// of the arena. Cells are numbered row by row, from the bottom left.
+namespace board {
+
+static constexpr float HalfSquare = 0.5f * Arena::SquareSize;
+
+static constexpr std::array<glm::vec2, Arena::NGrid> Centers = [] {
+  std::array<glm::vec2, Arena::NGrid> centers;
+  for (uint32_t i = 0; i < Arena::NGrid; ++i) {
+    glm::vec2 cell = {float(i % Arena::NX), float(i / Arena::NX)};
+    centers[i]     = Arena::CellSize * (cell + glm::vec2 {0.5f, 0.5f});
+  }
+  return centers;
+}();
+
+// Corners of the square in each cell, counter clockwise from the bottom left.
+static constexpr std::array<std::array<glm::vec2, 4>, Arena::NGrid> Corners = [] {
+  std::array<std::array<glm::vec2, 4>, Arena::NGrid> corners;
+  for (uint32_t i = 0; i < Arena::NGrid; ++i) {
+    glm::vec2 c = Centers[i];
+    corners[i]  = {c + glm::vec2 {-HalfSquare, -HalfSquare},
+                   c + glm::vec2 {HalfSquare, -HalfSquare},
+                   c + glm::vec2 {HalfSquare, HalfSquare},
+                   c + glm::vec2 {-HalfSquare, HalfSquare}};
+  }
+  return corners;
+}();
+
+}  // namespace board
@@ -0,0 +1,356 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <numbers>
+#include <random>
+#include <vector>
+
+#include <Board.h>
+#include <Game.h>
+#include <GridPhysics.h>
+#include <Jobs.h>
+#include <Replay.h>
+#include <Simd.h>
+#include <Solver.h>
+#include <fmt/format.h>
+
+// Checks what the physics backends and the recorded games promise, without rendering.
+// Exits non-zero if any check fails. Also worth running in a build with
+// CABBAGE_SANITIZE on.
+
+static std::string_view physicsName(Physics physics)
+{
+  return physics == Physics::Grid ? "grid" : "box2d";
+}
+
+// Fans every ball out from the bottom of a board half full of squares, and steps the grid
+// kernel on its own. No ball may sink into a solid square or cross a wall, and bounces
+// keep the speed. Balls that leave through the open bottom are done.
+static bool checkGridKernel()
+{
+  static constexpr uint32_t N      = Arena::NMaxBalls;
+  static constexpr uint32_t NSteps = 1200;
+  static constexpr float    Dt     = 1.f / 120.f;
+  // In arena units, a hundredth of a percent of a cell.
+  static constexpr float Tolerance = 1e-2f;
+  static constexpr float R         = Arena::BallRadius;
+
+  // The bottom row stays clear to launch from.
+  std::mt19937_64 rng(15);
+  uint64_t        solid = rng() & ~((uint64_t(1) << Arena::NX) - 1);
+  solid &= (uint64_t(1) << Arena::NGrid) - 1;
+
+  auto        grid  = std::make_unique<GridPhysics>();
+  const float range = std::numbers::pi_v<float> - 2.f * Arena::MinAngle;
+  for (uint32_t i = 0; i < N; ++i) {
+    float a        = Arena::MinAngle + range * (float(i) + 0.5f) / N;
+    grid->mPosX[i] = R + (Arena::Width - 2.f * R) * (float(i) + 0.5f) / N;
+    grid->mPosY[i] = R;
+    grid->mVelX[i] = Arena::BallSpeed * std::cos(a);
+    grid->mVelY[i] = Arena::BallSpeed * std::sin(a);
+  }
+
+  std::vector<uint32_t> hits, touched;
+  std::vector<bool>     out(N, false);
+  float                 overlap = 0.f;  // Deepest into a square or a wall.
+  float                 speed   = 0.f;  // Largest change of speed.
+  for (uint32_t s = 0; s < NSteps; ++s) {
+    grid->step(N, Dt, solid, 0, hits, touched);
+    hits.clear();
+    for (uint32_t i = 0; i < N; ++i) {
+      glm::vec2 p = {grid->mPosX[i], grid->mPosY[i]};
+      glm::vec2 v = {grid->mVelX[i], grid->mVelY[i]};
+      if (out[i] || p.y < R) {
+        out[i] = true;
+        continue;
+      }
+      overlap = std::max({overlap,
+                          R - p.x,
+                          p.x - (Arena::Width - R),
+                          p.y - (Arena::Height - R)});
+      for (uint32_t c = 0; c < Arena::NGrid; ++c) {
+        if ((solid >> c) & 1) {
+          const auto& corners = board::Corners[c];
+          overlap = std::max(overlap,
+                             R - glm::length(p - glm::clamp(p, corners[0], corners[2])));
+        }
+      }
+      speed = std::max(speed, std::abs(glm::length(v) - Arena::BallSpeed));
+    }
+  }
+  bool ok = overlap <= Tolerance && speed <= Tolerance;
+  fmt::print("grid kernel: {} balls over {} steps, {:.2e} deepest overlap, "
+             "{:.2e} largest change of speed: {}\n",
+             N,
+             NSteps,
+             overlap,
+             speed,
+             ok ? "ok" : "FAILED");
+  return ok;
+}
+
+// A ball that finds itself inside a square, from a missed contact or a square that
+// appeared on top of it, is pushed out through the nearest face in the next step. Checked
+// from the center and from near every face.
+static bool checkGridInside()
+{
+  static constexpr uint32_t Cell  = 3 * Arena::NX + 3;
+  static constexpr uint64_t Solid = uint64_t(1) << Cell;
+  static constexpr float    R     = Arena::BallRadius;
+  const std::array<glm::vec2, 5> offsets = {
+    glm::vec2 {0.f, 0.f}, {30.f, 5.f}, {-30.f, 5.f}, {5.f, 30.f}, {5.f, -30.f}};
+  const glm::vec2       ctr  = board::Centers[Cell];
+  const auto&           box  = board::Corners[Cell];
+  auto                  grid = std::make_unique<GridPhysics>();
+  std::vector<uint32_t> hits, touched;
+  for (uint32_t i = 0; i < offsets.size(); ++i) {
+    grid->mPosX[i] = ctr.x + offsets[i].x;
+    grid->mPosY[i] = ctr.y + offsets[i].y;
+    grid->mVelX[i] = 0.f;
+    grid->mVelY[i] = Arena::BallSpeed;
+  }
+  grid->step(uint32_t(offsets.size()), 1.f / 120.f, Solid, 0, hits, touched);
+  bool ok = true;
+  for (uint32_t i = 0; i < offsets.size(); ++i) {
+    glm::vec2 p = {grid->mPosX[i], grid->mPosY[i]};
+    ok &= glm::length(p - glm::clamp(p, box[0], box[2])) >= R - 1e-2f;
+  }
+  fmt::print("grid kernel, balls inside a square: {}\n", ok ? "ok" : "FAILED");
+  return ok;
+}
+
+// The broad phase kernel for this machine against the scalar one, on balls scattered
+// over and around the arena, some of them far outside. They have to agree bit for bit,
+// or a replay recorded on one machine plays out differently on another.
+static bool checkBroadPhase()
+{
+  // Not a multiple of any vector width, so the tails run too.
+  static constexpr size_t N = Arena::NMaxBalls - 3;
+  std::mt19937_64         rng(16);
+  std::uniform_real_distribution<float> pos(-0.5f, 1.5f), vel(-1.f, 1.f);
+  std::vector<float>                    x(N), y(N), vx(N), vy(N);
+  for (size_t i = 0; i < N; ++i) {
+    x[i]  = Arena::Width * pos(rng);
+    y[i]  = Arena::Height * pos(rng);
+    vx[i] = Arena::BallSpeed * vel(rng);
+    vy[i] = Arena::BallSpeed * vel(rng);
+  }
+  bool ok = true;
+  for (uint32_t round = 0; round < 100; ++round) {
+    const uint64_t       cells = rng();
+    const float          dt    = (round % 10 + 1) / 120.f;
+    std::vector<float>   sx = x, sy = y, dx = x, dy = y;
+    std::vector<uint8_t> snear(N), dnear(N);
+    simd::moveClearBallsScalar(
+      sx.data(), sy.data(), vx.data(), vy.data(), dt, cells, snear.data(), N);
+    simd::moveClearBalls(
+      dx.data(), dy.data(), vx.data(), vy.data(), dt, cells, dnear.data(), N);
+    ok &= std::memcmp(sx.data(), dx.data(), N * sizeof(float)) == 0
+          && std::memcmp(sy.data(), dy.data(), N * sizeof(float)) == 0 && snear == dnear;
+  }
+  fmt::print("broad phase ({} against scalar): {}\n",
+             simd::isaName(simd::isa()),
+             ok ? "ok" : "FAILED");
+  return ok;
+}
+
+// Records a game, and plays it back from the log.
+static bool checkReplay(Physics physics)
+{
+  static constexpr uint32_t NTurns = 200;
+  StepConfig                config;
+  config.mPhysics = physics;
+  std::string path =
+    (std::filesystem::temp_directory_path() / "cabbage-check.rep").string();
+  {
+    ReplayWriter recorder(path, 0, config);
+    if (!recorder.good()) {
+      fmt::print("replay ({}): cannot write to '{}'\n", physicsName(physics), path);
+      return false;
+    }
+    Simulation sim(config);
+    for (uint32_t turn = 0; turn < NTurns; ++turn) {
+      float angle = sim.arena().randomAngle(turn);
+      if (!sim.playTurn(turn, angle)) {
+        break;
+      }
+      recorder.write(TurnRecord(sim.arena(), turn, angle));
+    }
+  }
+  bool ok = playback(path) == 0;
+  std::error_code err;
+  std::filesystem::remove(path, err);
+  fmt::print("replay ({}): {}\n", physicsName(physics), ok ? "ok" : "FAILED");
+  return ok;
+}
+
+// Plays the same turns twice from a snapshot taken between turns, and compares the hash
+// after every turn. The second time, the snapshot is restored either into the same world
+// or into a fresh one.
+static bool checkRestore(Physics physics, bool fresh)
+{
+  static constexpr uint32_t NBefore = 10;
+  static constexpr uint32_t NTurns  = 20;
+  StepConfig                config;
+  config.mPhysics = physics;
+  Simulation sim(config);
+  for (uint32_t turn = 0; turn < NBefore; ++turn) {
+    sim.playTurn(turn, sim.arena().randomAngle(turn));
+  }
+  auto snap = std::make_unique<Arena::Snapshot>();
+  sim.arena().snapshot(*snap);
+  auto play = [](Simulation& target) {
+    std::vector<uint64_t> hashes;
+    for (uint32_t turn = NBefore; turn < NBefore + NTurns; ++turn) {
+      bool alive = target.playTurn(turn, target.arena().randomAngle(turn));
+      hashes.push_back(target.arena().hash());
+      if (!alive) {
+        break;
+      }
+    }
+    return hashes;
+  };
+  auto                        first = play(sim);
+  std::unique_ptr<Simulation> other;
+  if (fresh) {
+    other = std::make_unique<Simulation>(config);
+  }
+  Simulation& target = other ? *other : sim;
+  target.arena().restore(*snap);
+  bool ok = play(target) == first;
+  fmt::print("restore into {} world ({}): {}\n",
+             fresh ? "a fresh" : "the same",
+             physicsName(physics),
+             ok ? "ok" : physics == Physics::Grid ? "FAILED" : "differs");
+  return ok;
+}
+
+static uint32_t countBroken(const std::array<uint32_t, Arena::NGrid>& before,
+                            const std::array<uint32_t, Arena::NGrid>& after)
+{
+  uint32_t count = 0;
+  for (uint32_t i = 0; i < Arena::NGrid; ++i) {
+    Vertex b, a;
+    b.mPacked = before[i];
+    a.mPacked = after[i];
+    count += b.type() == SQUARE && a.type() != SQUARE;
+  }
+  return count;
+}
+
+// Plays the same turns with both backends. Box2D plays the game, and before every shot
+// its position is restored into a grid world that takes the same shot. The squares
+// broken and the point where the first ball lands are compared turn by turn, within the
+// tolerances stated in GridPhysics.h, and the largest divergence is printed.
+static bool checkBackends()
+{
+  static constexpr uint32_t NTurns           = 100;
+  static constexpr uint32_t BrokenTolerance  = 1;
+  static constexpr float    LandingTolerance = 0.25f * Arena::CellSize;
+  // Bounces amplify every small difference, so a few turns may go their own way.
+  static constexpr float MinAgreement = 0.9f;
+  StepConfig box2dConfig, gridConfig;
+  box2dConfig.mPhysics = Physics::Box2D;
+  gridConfig.mPhysics  = Physics::Grid;
+  Simulation box2d(box2dConfig);
+  Simulation grid(gridConfig);
+  auto       snap       = std::make_unique<Arena::Snapshot>();
+  uint32_t   nTurns     = 0;
+  uint32_t   nAgree     = 0;
+  uint32_t   maxBroken  = 0;
+  float      maxLanding = 0.f;
+  for (uint32_t turn = 0; turn < NTurns; ++turn) {
+    if (box2d.arena().advance(turn)) {
+      break;
+    }
+    box2d.arena().snapshot(*snap);
+    grid.arena().restore(*snap);
+    auto  before = box2d.arena().board();
+    float angle  = box2d.arena().randomAngle(turn);
+    box2d.playShot(angle);
+    grid.playShot(angle);
+    uint32_t a        = countBroken(before, box2d.arena().board());
+    uint32_t b        = countBroken(before, grid.arena().board());
+    uint32_t dBroken  = a > b ? a - b : b - a;
+    float    dLanding = std::abs(box2d.arena().launchPoint().x
+                                 - grid.arena().launchPoint().x);
+    maxBroken         = std::max(maxBroken, dBroken);
+    maxLanding        = std::max(maxLanding, dLanding);
+    nAgree += dBroken <= BrokenTolerance && dLanding <= LandingTolerance;
+    ++nTurns;
+  }
+  bool ok = nTurns > 0 && float(nAgree) >= MinAgreement * float(nTurns);
+  fmt::print("box2d against grid: {} of {} turns agree, at most {} squares broken and "
+             "{:.1f} units of landing apart: {}\n",
+             nAgree,
+             nTurns,
+             maxBroken,
+             maxLanding,
+             ok ? "ok" : "FAILED");
+  return ok;
+}
+
+// A few solver rounds, each solved twice with the same seed. With a budget that never
+// runs out, every shot is played and the best angle is in range. The chosen shot is then
+// played in the live world, which has to break the squares the solver predicted. Box2D
+// worlds don't replay a position exactly like each other, so only the grid has to pick
+// the same angle both times and match the prediction.
+static bool checkSolver(Physics physics)
+{
+  static constexpr uint32_t NShots = 64;
+  StepConfig                config;
+  config.mPhysics = physics;
+  JobSystem  jobs;
+  AimSolver  solver(jobs, config);
+  Simulation sim(config);
+  const float maxAngle = std::numbers::pi_v<float> - Arena::MinAngle;
+  bool        ok       = true;
+  bool        same     = true;
+  uint32_t    nMissed  = 0;  // Rounds that didn't break what the solver predicted.
+  for (uint32_t turn = 0; turn < 4; ++turn) {
+    if (sim.arena().advance(turn)) {
+      break;
+    }
+    Aim first  = solver.solve(sim.arena(), NShots, std::chrono::minutes(10), turn);
+    Aim second = solver.solve(sim.arena(), NShots, std::chrono::minutes(10), turn);
+    for (const Aim& aim : {first, second}) {
+      ok &= aim.mNumShots == NShots && aim.mBest.mAngle >= Arena::MinAngle
+            && aim.mBest.mAngle <= maxAngle;
+    }
+    same &= first.mBest.mAngle == second.mBest.mAngle;
+    auto before = sim.arena().board();
+    sim.playShot(first.mBest.mAngle);
+    nMissed += countBroken(before, sim.arena().board()) != first.mBest.mBroken;
+  }
+  if (physics == Physics::Grid) {
+    ok &= same && nMissed == 0;
+  }
+  fmt::print("solver ({}): {}, {} angle from the same seed, {} rounds broke other "
+             "squares than predicted\n",
+             physicsName(physics),
+             ok ? "ok" : "FAILED",
+             same ? "same" : "different",
+             nMissed);
+  return ok;
+}
+
+int main()
+{
+  bool ok = checkGridKernel();
+  ok &= checkGridInside();
+  ok &= checkBroadPhase();
+  for (auto physics : {Physics::Box2D, Physics::Grid}) {
+    ok &= checkReplay(physics);
+    ok &= checkSolver(physics);
+  }
+  ok &= checkRestore(Physics::Grid, false);
+  ok &= checkRestore(Physics::Grid, true);
+  // Box2D restores aren't promised to play on identically, see Arena::restore. Printed
+  // for information only.
+  checkRestore(Physics::Box2D, false);
+  ok &= checkBackends();
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,268 @@
+#include <Font.h>
+#include <Game.h>
+#include <fmt/format.h>
+#include <freetype/freetype.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <fstream>
+#include <iterator>
+#include <string_view>
+#include <vector>
+
+// Rasterizes the digits of the embedded font into the character atlases, and writes them
+// out as a header, so the game itself never has to load the font. Runs as part of the
+// build.
+
+static constexpr size_t   NChars     = 10;  // Just the numerical characters.
+static constexpr uint32_t FontHeight = uint32_t(0.25f * Arena::SquareSize);
+// The distance field is computed from glyphs rasterized this many times larger, and
+// sampled at SdfScale texels per pixel of the labels. Distances are stored up to
+// SdfSpread pixels of the labels away from the outline.
+static constexpr uint32_t SdfUpscale = 16;
+static constexpr uint32_t SdfScale   = 2;
+static constexpr uint32_t SdfSpread  = 2;
+
+struct Glyph
+{
+  uint32_t             mX = 0;  // Left edge of the tile in the atlas.
+  uint32_t             mWidth;  // Size of the tile in texels.
+  uint32_t             mHeight;
+  float                mBearingX;  // From the pen to the top left of the tile, in pixels.
+  float                mBearingY;
+  float                mAdvance;  // In pixels.
+  std::vector<uint8_t> mTile;     // Rows from the top.
+};
+
+struct Atlas
+{
+  uint32_t                  mWidth  = 0;
+  uint32_t                  mHeight = 0;
+  std::array<Glyph, NChars> mDigits;
+  std::vector<uint8_t>      mPixels;
+};
+
+// Loads every digit at the pixel size and hands the rendered glyph slot to the function.
+template<typename F>
+static bool rasterize(uint32_t pixelSize, FT_Int32 flags, F&& fn)
+{
+  FT_Library ftlib;
+  if (FT_Init_FreeType(&ftlib)) {
+    return false;
+  }
+  FT_Face face;
+  bool    success =
+    !FT_New_Memory_Face(ftlib, CascadiaMono_ttf.data(), CascadiaMono_ttf.size(), 0, &face)
+    && !FT_Set_Pixel_Sizes(face, 0, pixelSize);
+  for (size_t i = 0; success && i < NChars; ++i) {
+    if (FT_Load_Char(face, FT_ULong('0' + i), flags | FT_LOAD_RENDER)) {
+      success = false;
+      break;
+    }
+    fn(i, face->glyph);
+  }
+  FT_Done_FreeType(ftlib);
+  return success;
+}
+
+// Copies the rows of the bitmap, which can be padded.
+static std::vector<uint8_t> copyBitmap(const FT_Bitmap& bitmap)
+{
+  std::vector<uint8_t> pixels;
+  for (uint32_t r = 0; r < bitmap.rows; ++r) {
+    const uint8_t* row = bitmap.buffer + r * bitmap.pitch;
+    pixels.insert(pixels.end(), row, row + bitmap.width);
+  }
+  return pixels;
+}
+
+// The digits as the font hints them at the size of the labels, to draw at exactly that
+// size.
+static bool bitmapGlyphs(std::array<Glyph, NChars>& glyphs)
+{
+  return rasterize(FontHeight, FT_LOAD_DEFAULT, [&](size_t i, FT_GlyphSlot slot) {
+    Glyph& g    = glyphs[i];
+    g.mWidth    = slot->bitmap.width;
+    g.mHeight   = slot->bitmap.rows;
+    g.mBearingX = float(slot->bitmap_left);
+    g.mBearingY = float(slot->bitmap_top);
+    g.mAdvance  = float(slot->advance.x >> 6);  // From 1/64th of a pixel.
+    g.mTile     = copyBitmap(slot->bitmap);
+  });
+}
+
+// Signed distance to the outline at each texel, mapped from [-spread, spread] to
+// [0, 255] with the outline at 128, positive inside. It is computed by brute force from
+// an unhinted rendering SdfUpscale times larger, which is fine for ten glyphs at build
+// time.
+static bool sdfGlyphs(std::array<Glyph, NChars>& glyphs)
+{
+  constexpr int   Step   = int(SdfUpscale / SdfScale);     // Large pixels per texel.
+  constexpr int   Pad    = int(SdfSpread * SdfScale);      // Texels around the glyph.
+  constexpr float Spread = float(SdfSpread * SdfUpscale);  // In large pixels.
+  constexpr int   Reach  = int(Spread) + Step;
+  constexpr float Up     = float(SdfUpscale);
+  return rasterize(
+    FontHeight * SdfUpscale, FT_LOAD_NO_HINTING, [&](size_t i, FT_GlyphSlot slot) {
+      const int            w      = int(slot->bitmap.width);
+      const int            h      = int(slot->bitmap.rows);
+      std::vector<uint8_t> bitmap = copyBitmap(slot->bitmap);
+      auto                 inside = [&](int x, int y) {
+        return x >= 0 && y >= 0 && x < w && y < h && bitmap[y * w + x] >= 128;
+      };
+      Glyph& g    = glyphs[i];
+      g.mWidth    = uint32_t((w + Step - 1) / Step + 2 * Pad);
+      g.mHeight   = uint32_t((h + Step - 1) / Step + 2 * Pad);
+      g.mBearingX = float(slot->bitmap_left) / Up - float(SdfSpread);
+      g.mBearingY = float(slot->bitmap_top) / Up + float(SdfSpread);
+      g.mAdvance  = float(slot->advance.x) / (64.f * Up);
+      g.mTile.resize(g.mWidth * g.mHeight);
+      for (int ty = 0; ty < int(g.mHeight); ++ty) {
+        for (int tx = 0; tx < int(g.mWidth); ++tx) {
+          // Center of the texel, in large pixels from the top left of the bitmap.
+          float cx   = (float(tx - Pad) + 0.5f) * float(Step);
+          float cy   = (float(ty - Pad) + 0.5f) * float(Step);
+          int   px   = int(std::floor(cx));
+          int   py   = int(std::floor(cy));
+          bool  in   = inside(px, py);
+          float best = Spread + 0.5f;
+          for (int y = py - Reach; y <= py + Reach; ++y) {
+            for (int x = px - Reach; x <= px + Reach; ++x) {
+              if (inside(x, y) != in) {
+                best = std::min(best,
+                                std::hypot(float(x) + 0.5f - cx, float(y) + 0.5f - cy));
+              }
+            }
+          }
+          // The outline runs half way between the pixel centers.
+          float dist = std::min(best - 0.5f, Spread) * (in ? 1.f : -1.f);
+          float val  = std::clamp(0.5f + 0.5f * dist / Spread, 0.f, 1.f);
+          g.mTile[ty * g.mWidth + tx] = uint8_t(std::lround(255.f * val));
+        }
+      }
+    });
+}
+
+// Puts the tiles side by side, top aligned.
+static Atlas pack(std::array<Glyph, NChars> glyphs)
+{
+  Atlas atlas;
+  for (Glyph& g : glyphs) {
+    g.mX = atlas.mWidth;
+    atlas.mWidth += g.mWidth;
+    atlas.mHeight = std::max(atlas.mHeight, g.mHeight);
+  }
+  // make it a multiple of 4 for alignment.
+  if (atlas.mWidth % 4) {
+    atlas.mWidth += 4 - (atlas.mWidth % 4);
+  }
+  atlas.mPixels.resize(atlas.mWidth * atlas.mHeight, 0);
+  for (const Glyph& g : glyphs) {
+    for (uint32_t r = 0; r < g.mHeight; ++r) {
+      std::copy_n(g.mTile.data() + r * g.mWidth,
+                  g.mWidth,
+                  atlas.mPixels.data() + r * atlas.mWidth + g.mX);
+    }
+  }
+  atlas.mDigits = std::move(glyphs);
+  return atlas;
+}
+
+static void write(std::ostreambuf_iterator<char> out,
+                  std::string_view               name,
+                  std::string_view               comment,
+                  const Atlas&                   atlas,
+                  uint32_t                       scale)
+{
+  fmt::format_to(out,
+                 "// {}\n"
+                 "static constexpr Atlas {} = {{{}, {}, {}, {{{{\n",
+                 comment,
+                 name,
+                 atlas.mWidth,
+                 atlas.mHeight,
+                 scale);
+  for (const Glyph& g : atlas.mDigits) {
+    fmt::format_to(out,
+                   "  {{{}, {}, {}, {:.6f}f, {:.6f}f, {:.6f}f}},\n",
+                   g.mX,
+                   g.mWidth,
+                   g.mHeight,
+                   g.mBearingX,
+                   g.mBearingY,
+                   g.mAdvance);
+  }
+  fmt::format_to(out,
+                 "}}}}}};\n\n"
+                 "static constexpr std::array<uint8_t, {}> {}Pixels = {{{{",
+                 atlas.mPixels.size(),
+                 name);
+  for (size_t i = 0; i < atlas.mPixels.size(); ++i) {
+    fmt::format_to(out, "{}0x{:02x},", i % 16 ? " " : "\n  ", atlas.mPixels[i]);
+  }
+  fmt::format_to(out, "\n}}}};\n\n");
+}
+
+int main(int argc, char** argv)
+{
+  if (argc != 2) {
+    fmt::print(stderr, "Usage: {} OUTPUT_HEADER\n", argv[0]);
+    return 1;
+  }
+  std::array<Glyph, NChars> bitmap;
+  std::array<Glyph, NChars> sdf;
+  if (!bitmapGlyphs(bitmap) || !sdfGlyphs(sdf)) {
+    fmt::print(stderr, "Unable to rasterize the font.\n");
+    return 1;
+  }
+  const uint32_t height = bitmap[0].mHeight;
+  if (std::any_of(bitmap.begin(), bitmap.end(), [height](const Glyph& g) {
+        return g.mHeight != height;
+      })) {
+    fmt::print(stderr,
+               "The font face does not provide uniform height numerical characters.\n");
+    return 1;
+  }
+
+  std::ofstream file(argv[1]);
+  if (!file) {
+    fmt::print(stderr, "Cannot write to '{}'.\n", argv[1]);
+    return 1;
+  }
+  auto out = std::ostreambuf_iterator<char>(file);
+  fmt::format_to(out,
+                 "#pragma once\n\n"
+                 "#include <stdint.h>\n"
+                 "#include <array>\n\n"
+                 "// Generated by cabbage_fontgen from Font.h. Do not edit.\n"
+                 "namespace glyphs {{\n\n"
+                 "struct Glyph\n"
+                 "{{\n"
+                 "  uint32_t mX;      // Left edge of the tile in the atlas.\n"
+                 "  uint32_t mWidth;  // Size of the tile in texels.\n"
+                 "  uint32_t mHeight;\n"
+                 "  float    mBearingX;  // From the pen to the top left of the tile.\n"
+                 "  float    mBearingY;\n"
+                 "  float    mAdvance;\n"
+                 "}};\n\n"
+                 "// Distances are in pixels of the labels.\n"
+                 "struct Atlas\n"
+                 "{{\n"
+                 "  uint32_t              mWidth;\n"
+                 "  uint32_t              mHeight;\n"
+                 "  uint32_t              mScale;  // Texels per pixel.\n"
+                 "  std::array<Glyph, {}> mDigits;\n"
+                 "}};\n\n"
+                 "// clang-format off\n",
+                 NChars);
+  write(out, "Bitmap", "Coverage, hinted for the size of the labels.", pack(bitmap), 1);
+  write(out,
+        "Sdf",
+        fmt::format("Signed distance to the outline, {} pixels either way.", SdfSpread),
+        pack(sdf),
+        SdfScale);
+  fmt::format_to(out,
+                 "// clang-format on\n\n"
+                 "}}  // namespace glyphs\n");
+  return 0;
+}
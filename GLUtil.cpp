@@ -1,15 +1,22 @@
 #include <GLUtil.h>
 #include <Game.h>
-#include <freetype/freetype.h>
+#include <Glsl.h>
+#include <Trace.h>
 #include <spdlog/sinks/stdout_color_sinks.h>
 #include <spdlog/spdlog.h>
+#include <algorithm>
 #include <array>
-#include <iomanip>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <limits>
 #include <numeric>
-#include <sstream>
+#include <optional>
 #include <string_view>
 
-#include <Font.h>
+// Generated at build time.
+#include <Glyphs.h>
 
 namespace view {
 
@@ -44,424 +51,564 @@ void clear_errors()
   }
 }
 
-static constexpr size_t NChars = 10;  // Just the numerical characters.
+static void glfw_error_cb(int error, const char* desc)
+{
+  logger().error("GLFW Error {}: {}", error, desc);
+}
 
-static void getFontData(std::vector<uint8_t>&           textureData,
-                        std::array<size_t, NChars>&     offsets,
-                        std::array<glm::ivec2, NChars>& sizes,
-                        std::array<glm::ivec2, NChars>& bearings,
-                        std::array<uint32_t, NChars>&   advances,
-                        uint32_t&                       charHeight)
+int initGL(GLFWwindow*& window, bool visible)
 {
-  static constexpr std::string_view sErr       = "Unable to load font data";
-  static constexpr uint32_t         FontHeight = uint32_t(0.25f * Arena::SquareSize);
-  logger().info("Loading font...");
-  FT_Library ftlib;
-  if (FT_Init_FreeType(&ftlib)) {
-    logger().error(sErr);
-    return;
+  glfwSetErrorCallback(glfw_error_cb);
+  if (!glfwInit()) {
+    logger().error("Failed to initialize GLFW.");
+    return 1;
   }
-  FT_Face face;
-  if (FT_New_Memory_Face(
-        ftlib, CascadiaMono_ttf.data(), CascadiaMono_ttf.size(), 0, &face)) {
-    logger().error(sErr);
-    return;
+  logger().info("Initialized GLFW.");
+  // Window setup
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+  glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
+  // Size the window in screen coordinates on every platform, so it is as large on a
+  // HiDPI monitor. The framebuffer then has more pixels than the window.
+  glfwWindowHint(GLFW_SCALE_TO_MONITOR, GLFW_TRUE);
+  glfwWindowHint(GLFW_VISIBLE, visible ? GLFW_TRUE : GLFW_FALSE);
+  std::string title = "Cabbage";
+  window = glfwCreateWindow(Arena::Width, Arena::Height, title.c_str(), nullptr, nullptr);
+  if (window == nullptr) {
+    return 1;
+  }
+  glfwMakeContextCurrent(window);
+  // OpenGL bindings
+  int err = GLEW_OK;
+  if ((err = glewInit()) != GLEW_OK) {
+    logger().error("Failed to initialize OpenGL bindings: {}", err);
+    return 1;
+  }
+  logger().info("OpenGL bindings are ready.");
+  int W, H;
+  GL_CALL(glfwGetFramebufferSize(window, &W, &H));
+  GL_CALL(glViewport(0, 0, W, H));
+  GL_CALL(glEnable(GL_DEPTH_TEST));
+  GL_CALL(glEnable(GL_BLEND));
+  GL_CALL(glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA));
+  GL_CALL(glEnable(GL_LINE_SMOOTH));
+  GL_CALL(glEnable(GL_PROGRAM_POINT_SIZE));
+  GL_CALL(glPointSize(3.0f));
+  GL_CALL(glLineWidth(1.0f));
+  GL_CALL(glPolygonMode(GL_FRONT_AND_BACK, GL_FILL));
+  return 0;
+}
+
+// Mirrors the View uniform block, laid out with std140.
+struct ViewBlock
+{
+  glm::mat4 mProjection;
+  glm::vec4 mViewport;
+  glm::vec2 mArenaSize;
+  glm::vec2 mPad;
+};
+
+// Mirrors the Board uniform block, laid out with std140. Array elements are padded to a
+// vec4.
+struct BoardBlock
+{
+  int32_t                                    mMaxData;
+  int32_t                                    mPad[3];
+  std::array<glm::vec4, BoardStyle::NColors> mColors;
+  glm::vec4                                  mSpawnColor;
+};
+static_assert(offsetof(BoardBlock, mColors) == 16);
+
+static constexpr glm::vec4 ClearColor = {0.1f, 0.1f, 0.1f, 1.f};
+
+Screen::Screen(GLFWwindow* window, float renderScale)
+    : mWindow(window)
+    , mRenderScale(renderScale)
+{
+  GL_CALL(glGenBuffers(1, &mUbo));
+  GL_CALL(glBindBuffer(GL_UNIFORM_BUFFER, mUbo));
+  GL_CALL(glBufferData(GL_UNIFORM_BUFFER, sizeof(ViewBlock), nullptr, GL_DYNAMIC_DRAW));
+  GL_CALL(glBindBuffer(GL_UNIFORM_BUFFER, 0));
+  GL_CALL(glBindBufferBase(GL_UNIFORM_BUFFER, ViewBinding, mUbo));
+  if (mRenderScale != 1.f) {
+    GL_CALL(glGenFramebuffers(1, &mFbo));
+    GL_CALL(glGenRenderbuffers(1, &mColor));
+    GL_CALL(glGenRenderbuffers(1, &mDepth));
+  }
+  int width, height;
+  glfwGetFramebufferSize(mWindow, &width, &height);
+  resize(width, height);
+  glfwSetWindowUserPointer(mWindow, this);
+  glfwSetFramebufferSizeCallback(mWindow, &Screen::onResize);
+}
+
+Screen::~Screen()
+{
+  free();
+}
+
+void Screen::free()
+{
+  if (mWindow) {
+    glfwSetFramebufferSizeCallback(mWindow, nullptr);
+    glfwSetWindowUserPointer(mWindow, nullptr);
+    mWindow = nullptr;
   }
-  if (FT_Set_Pixel_Sizes(face, 0, FontHeight)) {
-    logger().error(sErr);
+  if (mUbo) {
+    GL_CALL(glDeleteBuffers(1, &mUbo));
+    mUbo = 0;
+  }
+  if (mFbo) {
+    GL_CALL(glDeleteFramebuffers(1, &mFbo));
+    mFbo = 0;
+  }
+  if (mColor) {
+    GL_CALL(glDeleteRenderbuffers(1, &mColor));
+    mColor = 0;
+  }
+  if (mDepth) {
+    GL_CALL(glDeleteRenderbuffers(1, &mDepth));
+    mDepth = 0;
+  }
+}
+
+void Screen::onResize(GLFWwindow* window, int width, int height)
+{
+  if (auto* screen = static_cast<Screen*>(glfwGetWindowUserPointer(window))) {
+    screen->resize(width, height);
+  }
+}
+
+void Screen::resize(int width, int height)
+{
+  // Nothing to draw into while the window is minimized.
+  if (width <= 0 || height <= 0) {
     return;
   }
-  char ch[2];
-  ch[1] = '\0';
-  for (int i = 0; i < 10; ++i) {
-    std::sprintf(ch, "%d", i);
-    if (FT_Load_Char(face, ch[0], FT_LOAD_RENDER)) {
-      logger().error(sErr);
-      return;
+  mSize = {width, height};
+  // The largest rectangle with the aspect ratio of the arena, centered.
+  float scale = std::min(float(width) / Arena::Width, float(height) / Arena::Height);
+  mExtent     = {std::max(1, int(std::lround(Arena::Width * scale))),
+                 std::max(1, int(std::lround(Arena::Height * scale)))};
+  mOrigin     = {(width - mExtent.x) / 2, (height - mExtent.y) / 2};
+  ViewBlock block;
+  block.mProjection = glm::mat4(1.f);
+  block.mArenaSize  = {Arena::Width, Arena::Height};
+  if (mFbo) {
+    // The arena fills the offscreen framebuffer, the blit puts it in place.
+    mTarget = {std::max(1, int(std::lround(float(mExtent.x) * mRenderScale))),
+               std::max(1, int(std::lround(float(mExtent.y) * mRenderScale)))};
+    GL_CALL(glBindRenderbuffer(GL_RENDERBUFFER, mColor));
+    GL_CALL(glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, mTarget.x, mTarget.y));
+    GL_CALL(glBindRenderbuffer(GL_RENDERBUFFER, mDepth));
+    GL_CALL(
+      glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, mTarget.x, mTarget.y));
+    GL_CALL(glBindRenderbuffer(GL_RENDERBUFFER, 0));
+    GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, mFbo));
+    GL_CALL(glFramebufferRenderbuffer(
+      GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, mColor));
+    GL_CALL(glFramebufferRenderbuffer(
+      GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, mDepth));
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+      logger().error("The offscreen framebuffer is incomplete.");
     }
-    uint32_t width  = face->glyph->bitmap.width;
-    uint32_t height = face->glyph->bitmap.rows;
-    if (i == 0) {
-      charHeight = height;
-    }
-    else if (charHeight != height) {
-      logger().error(
-        "The font face does not provide uniform height numerical characters.");
-      return;
-    }
-    sizes[i]    = glm::ivec2 {int(width), int(height)};
-    bearings[i] = glm::ivec2(face->glyph->bitmap_left, face->glyph->bitmap_top);
-    offsets[i]  = textureData.size();
-    advances[i] = face->glyph->advance.x;
-    std::copy_n(reinterpret_cast<uint8_t*>(face->glyph->bitmap.buffer),
-                width * height,
-                std::back_inserter(textureData));
+    GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+    block.mViewport = {0.f, 0.f, float(mTarget.x), float(mTarget.y)};
+  }
+  else {
+    // Scale and offset the arena into its rectangle, the rest is cleared.
+    glm::vec2 size          = {float(mSize.x), float(mSize.y)};
+    glm::vec2 origin        = {float(mOrigin.x), float(mOrigin.y)};
+    glm::vec2 extent        = {float(mExtent.x), float(mExtent.y)};
+    glm::vec2 offset        = (2.f * origin + extent) / size - glm::vec2 {1.f, 1.f};
+    block.mProjection[0][0] = extent.x / size.x;
+    block.mProjection[1][1] = extent.y / size.y;
+    block.mProjection[3][0] = offset.x;
+    block.mProjection[3][1] = offset.y;
+    block.mViewport         = glm::vec4(origin, extent);
   }
-  FT_Done_Face(face);
-  FT_Done_FreeType(ftlib);
+  GL_CALL(glBindBuffer(GL_UNIFORM_BUFFER, mUbo));
+  GL_CALL(glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(block), &block));
+  GL_CALL(glBindBuffer(GL_UNIFORM_BUFFER, 0));
 }
 
-class CharAtlas
+void Screen::begin() const
 {
-  std::array<glm::ivec2, NChars> mBearings;
-  std::array<glm::ivec2, NChars> mSizes;
-  std::array<uint32_t, NChars>   mAdvances;
-  std::array<glm::vec4, NChars>  mTexCoords;
-  uint32_t                       mCharHeight;
-  std::vector<uint8_t>           mTexture;
-  uint32_t                       mTexId = 0;
+  if (mFbo) {
+    GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, mFbo));
+    GL_CALL(glViewport(0, 0, mTarget.x, mTarget.y));
+  }
+  else {
+    GL_CALL(glViewport(0, 0, mSize.x, mSize.y));
+  }
+  GL_CALL(glClearColor(ClearColor[0], ClearColor[1], ClearColor[2], ClearColor[3]));
+  GL_CALL(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
+}
 
-  CharAtlas()
-  {
-    std::vector<uint8_t>       textureData;
-    std::array<size_t, NChars> offsets;
-    getFontData(textureData, offsets, mSizes, mBearings, mAdvances, mCharHeight);
-    uint32_t tileX = uint32_t(
-      std::max_element(mSizes.begin(), mSizes.end(), [](glm::ivec2 a, glm::ivec2 b) {
-        return a[0] < b[0];
-      })->x);
-    uint32_t texWidth = tileX * NChars;
-    // make it a multiple of 4 for alignment.
-    if (texWidth % 4) {
-      texWidth += 4 - (texWidth % 4);
-    }
-    mTexture.resize(mCharHeight * texWidth, 0);
-    float    wf        = float(texWidth);
-    float    hf        = float(mCharHeight);
-    uint8_t* tilestart = mTexture.data();
-    uint32_t tx        = 0;
-    for (int i = 0; i < NChars; ++i) {
-      size_t   offset = offsets[i];
-      uint8_t* src    = textureData.data() + offset;
-      auto     dims   = mSizes[i];
-      uint8_t* dst    = tilestart;
-      tilestart += tileX;
-      for (uint32_t r = 0; r < dims.y; r++) {
-        std::copy_n(src, dims.x, dst);
-        src += dims.x;
-        dst += texWidth;
-      }
-      mTexCoords[i] = {float(tx) / wf, 0.f, float(tx + dims.x) / wf, 1.f};
-      tx += tileX;
-    }
-    // Init OpenGL texture.
-    GLint pixformat = GL_RED;
-    GL_CALL(glGenTextures(1, &mTexId));
-    GL_CALL(glBindTexture(GL_TEXTURE_2D, mTexId));
-    GL_CALL(glTexImage2D(GL_TEXTURE_2D,
-                         0,
-                         GL_RED,
-                         texWidth,
-                         mCharHeight,
-                         0,
-                         GL_RED,
-                         GL_UNSIGNED_BYTE,
-                         mTexture.data()));
-    GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
-    GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
-    GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
-    GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
-    GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
-  }
-
-  ~CharAtlas()
-  {
-    if (mTexId) {
-      GL_CALL(glDeleteTextures(1, &mTexId));
-      mTexId = 0;
-    }
+void Screen::end() const
+{
+  if (!mFbo) {
+    return;
   }
+  GL_CALL(glBindFramebuffer(GL_READ_FRAMEBUFFER, mFbo));
+  GL_CALL(glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0));
+  GL_CALL(glViewport(0, 0, mSize.x, mSize.y));
+  GL_CALL(glClear(GL_COLOR_BUFFER_BIT));
+  GL_CALL(glBlitFramebuffer(0,
+                            0,
+                            mTarget.x,
+                            mTarget.y,
+                            mOrigin.x,
+                            mOrigin.y,
+                            mOrigin.x + mExtent.x,
+                            mOrigin.y + mExtent.y,
+                            GL_COLOR_BUFFER_BIT,
+                            GL_LINEAR));
+  GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+}
 
-public:
-  void bind() const { GL_CALL(glBindTexture(GL_TEXTURE_2D, mTexId)); }
+glm::vec2 Screen::toArena(glm::vec2 point) const
+{
+  // Window coordinates run down from the top left, and can be smaller than pixels.
+  int width, height;
+  glfwGetWindowSize(mWindow, &width, &height);
+  if (width <= 0 || height <= 0) {
+    return {0.f, 0.f};
+  }
+  glm::vec2 pixel = {point.x * float(mSize.x) / float(width),
+                     float(mSize.y) - point.y * float(mSize.y) / float(height)};
+  glm::vec2 t     = (pixel - glm::vec2 {float(mOrigin.x), float(mOrigin.y)})
+                / glm::vec2 {float(mExtent.x), float(mExtent.y)};
+  return t * glm::vec2 {Arena::Width, Arena::Height};
+}
 
-  static CharAtlas& get()
-  {
-    static CharAtlas sAtlas;
-    return sAtlas;
+static_assert(glyphs::Bitmap.mDigits.size() == CharAtlas::NChars);
+static_assert(glyphs::Sdf.mDigits.size() == CharAtlas::NChars);
+
+CharAtlas::CharAtlas(Font font)
+{
+  // The atlases are rasterized at build time, see FontGen.cpp.
+  const glyphs::Atlas& atlas  = font == Font::Sdf ? glyphs::Sdf : glyphs::Bitmap;
+  const uint8_t*       pixels = font == Font::Sdf ? glyphs::SdfPixels.data()
+                                                  : glyphs::BitmapPixels.data();
+  const glm::vec2      texSize = {float(atlas.mWidth), float(atlas.mHeight)};
+  for (size_t i = 0; i < NChars; ++i) {
+    const glyphs::Glyph& g    = atlas.mDigits[i];
+    glm::vec2            size = {float(g.mWidth), float(g.mHeight)};
+    mSizes[i]                 = size / float(atlas.mScale);
+    mBearings[i]              = {g.mBearingX, g.mBearingY};
+    mAdvances[i]              = g.mAdvance;
+    // The rows run from the top of the glyph down.
+    glm::vec2 tmin = glm::vec2 {float(g.mX), 0.f} / texSize;
+    glm::vec2 tmax = tmin + size / texSize;
+    mTexCoords[i]  = {tmin.x, tmax.y, tmax.x, tmin.y};
   }
+  // Init OpenGL texture.
+  GL_CALL(glGenTextures(1, &mTexId));
+  GL_CALL(glBindTexture(GL_TEXTURE_2D, mTexId));
+  GL_CALL(glTexImage2D(GL_TEXTURE_2D,
+                       0,
+                       GL_RED,
+                       atlas.mWidth,
+                       atlas.mHeight,
+                       0,
+                       GL_RED,
+                       GL_UNSIGNED_BYTE,
+                       pixels));
+  GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+  GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+  GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+  GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+  GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
+}
 
-  const glm::vec4& textureCoords(int digit) { return mTexCoords[digit]; }
+CharAtlas::~CharAtlas()
+{
+  if (mTexId) {
+    GL_CALL(glDeleteTextures(1, &mTexId));
+    mTexId = 0;
+  }
+}
 
-  std::string glslConstants() const
-  {
-    std::stringstream ss;
-    ss << "const vec2 CharSizes[" << NChars << "] = vec2[](\n";
-    for (int i = 0; i < NChars; ++i) {
-      glm::vec2 s = 2.f * glm::vec2 {float(mSizes[i].x) / Arena::Width,
-                                     float(mSizes[i].y / Arena::Height)};
-      ss << "  vec2(" << s.x << ", " << s.y << ")" << (i + 1 < NChars ? "," : "") << "\n";
-    }
-    ss << ");\n";
-    ss << "const vec2 CharBearings[" << NChars << "] = vec2[](\n";
-    for (int i = 0; i < NChars; ++i) {
-      glm::vec2 s = 2.f * glm::vec2 {float(mBearings[i].x) / Arena::Width,
-                                     float(mBearings[i].y / Arena::Height)};
-      ss << "  vec2(" << s.x << ", " << s.y << ")" << (i + 1 < NChars ? "," : "") << "\n";
-    }
-    ss << ");\n";
-    ss << "const float CharAdvances[" << NChars << "] = float[](";
-    ss << std::setprecision(8);
-    for (int i = 0; i < NChars; ++i) {
-      // Advances need to be divided by 64 to get the number of pixels.
-      float a = 2.f * float(mAdvances[i] >> 6) / Arena::Width;
-      ss << a << (i + 1 < NChars ? ", " : "");
-    }
-    ss << ");\n";
-    ss << "const vec4 CharTxCoords[" << NChars << "] = vec4[](\n";
-    for (int i = 0; i < NChars; ++i) {
-      const auto& t = mTexCoords[i];
-      ss << "  vec4(" << t[0] << ", " << t[1] << ", " << t[2] << ", " << t[3] << ")"
-         << (i + 1 < NChars ? "," : "") << "\n";
-    }
-    ss << ");\n";
-    return ss.str();
+void CharAtlas::bind() const
+{
+  GL_CALL(glBindTexture(GL_TEXTURE_2D, mTexId));
+}
+
+CharAtlas& CharAtlas::get(Font font)
+{
+  // Each is only uploaded once something draws with it.
+  if (font == Font::Sdf) {
+    static CharAtlas sSdf(Font::Sdf);
+    return sSdf;
   }
+  static CharAtlas sBitmap(Font::Bitmap);
+  return sBitmap;
+}
+
+static constexpr std::string_view GlslVersion = "#version 330 core\n";
+
+// Everything up to the projection works in the space where the arena spans [-1, 1] on
+// both axes. Screen keeps the block up to date with the window.
+static constexpr auto sViewBlock = [] {
+  glsl::FixedString<512> s;
+  s << R"(
+layout(std140) uniform View
+{
+  mat4 Projection;  // From the arena to clip space.
+  vec4 Viewport;    // Origin and size of the arena in the framebuffer, in pixels.
+  vec2 ArenaSize;   // In arena coordinates.
 };
+)";
+  return s;
+}();
 
-static std::string vertShaderSrc()
+// The colors of the board, which GLSink can change at runtime.
+static constexpr auto sBoardBlock = [] {
+  glsl::FixedString<512> s;
+  s << R"(
+layout(std140) uniform Board
 {
-  static constexpr char sTemplate[] = R"(
-#version 330 core
+  int  MaxData;  // Squares with more data share the last color.
+  vec4 Colors[)" << uint32_t(BoardStyle::NColors) << R"(];
+  vec4 SpawnColor;
+};
+)";
+  return s;
+}();
+
+// Constants shared by the arena shaders. The layout of the vertices only changes with the
+// code that writes them, and the sizes with the physics. Sizes are half extents, where
+// the arena spans [-1, 1].
+static constexpr auto sArenaConstants = [] {
+  glsl::FixedString<1024> s;
+  s << "const uint TypeBits = " << Vertex::TypeBits << "u;\n"
+    << "const uint TypeMask = " << Vertex::TypeMask << "u;\n"
+    << "const int NOSQUARE = " << int(NOSQUARE) << ";\n"
+    << "const int SQUARE = " << int(SQUARE) << ";\n"
+    << "const int BALL_SPWN = " << int(BALL_SPWN) << ";\n"
+    << "const int NOBALL = " << int(NOBALL) << ";\n"
+    << "const int BALL = " << int(BALL) << ";\n"
+    << "const vec2 SqSize = vec2(" << Arena::SquareSize / Arena::Width << ", "
+    << Arena::SquareSize / Arena::Height << ");\n"
+    << "const vec2 BallSize = vec2(" << 2.f * Arena::BallRadius / Arena::Width << ", "
+    << 2.f * Arena::BallRadius / Arena::Height << ");\n"
+    << sViewBlock.view() << sBoardBlock.view();
+  return s;
+}();
 
+static constexpr auto sVertShader = [] {
+  glsl::FixedString s;
+  s << GlslVersion << sArenaConstants.view() << R"(
 layout(location = 0) in vec2 position;
-layout(location = 1) in int data;
-layout(location = 2) in int type;
+layout(location = 1) in uint attribs;
 
 out int Data;
 out int Type;
 
 void main()
-{{
-  Data = data;
-  Type = type;
-  vec2 pos = position;
-  pos.x = 2. * (position.x / {width:.8f}) - 1.;
-  pos.y = 2. * (position.y / {height:.8f}) - 1.;
+{
+  Data = int(attribs >> TypeBits);
+  Type = int(attribs & TypeMask);
+  vec2 pos = 2. * (position / ArenaSize) - vec2(1, 1);
+  // Projected by the geometry shader, once the quad is built.
   gl_Position = vec4(pos.xy, 0., 1.);
-}}
-)";
-  return fmt::format(
-    sTemplate, fmt::arg("width", Arena::Width), fmt::arg("height", Arena::Height));
 }
+)";
+  return s;
+}();
 
-static constexpr glm::vec2 GlslBallDim =
-  2.f * glm::vec2 {Arena::BallRadius / Arena::Width, Arena::BallRadius / Arena::Height};
-
-static std::string geoShaderSrc()
-{
-  static constexpr char sTemplate[] = R"(
-#version 330 core
+static constexpr auto sGeoShader = [] {
+  glsl::FixedString s;
+  s << GlslVersion << sArenaConstants.view() << R"(
 layout (points) in;
 layout (triangle_strip, max_vertices = 4) out;
 
-const int NOSQUARE       = {nosq};
-const int SQUARE         = {sq};
-const int BALL_SPWN      = {bspwn};
-const int NOBALL         = {nbl};
-const int BALL           = {bl};
-
-const vec2 sqx = vec2({xx:.8f}, 0.);
-const vec2 sqy = vec2(0., {yy:.8f});
-const float BallSizeX = {bsizex:.8f};
-const float BallSizeY = {bsizey:.8f};
-
 in int Data[];
 in int Type[];
 flat out int FData;
 flat out int FType;
 flat out vec2 ObjPos;
 
-void main() {{
+void main() {
+  vec2 sqx = vec2(SqSize.x, 0.);
+  vec2 sqy = vec2(0., SqSize.y);
   FData = Data[0];
   FType = Type[0];
   ObjPos = gl_in[0].gl_Position.xy;
   vec2 x = vec2(0,0);
   vec2 y = vec2(0,0);
   bool emit = false;
-  if (Type[0] == SQUARE) {{
+  if (Type[0] == SQUARE) {
     x = sqx;
     y = sqy;
     emit = true;
-  }} else if (Type[0] == BALL) {{
-    x = vec2(BallSizeX, 0.);
-    y = vec2(0., BallSizeY);
+  } else if (Type[0] == BALL) {
+    x = vec2(BallSize.x, 0.);
+    y = vec2(0., BallSize.y);
     emit = true;
-  }}
-  else if (Type[0] == BALL_SPWN) {{
+  }
+  else if (Type[0] == BALL_SPWN) {
     x = sqx * 0.75;
     y = sqy * 0.75;
     emit = true;
-  }}
-  if (emit) {{
+  }
+  if (emit) {
     vec2 pos = gl_in[0].gl_Position.xy;
-    gl_Position = vec4(pos - x - y, 0., 1.);
+    gl_Position = Projection * vec4(pos - x - y, 0., 1.);
     EmitVertex();
-    gl_Position = vec4(pos + x - y, 0., 1.);
+    gl_Position = Projection * vec4(pos + x - y, 0., 1.);
     EmitVertex();
-    gl_Position = vec4(pos - x + y, 0., 1.);
+    gl_Position = Projection * vec4(pos - x + y, 0., 1.);
     EmitVertex();
-    gl_Position = vec4(pos + x + y, 0., 1.);
+    gl_Position = Projection * vec4(pos + x + y, 0., 1.);
     EmitVertex();
     EndPrimitive();
-  }}
-}}
-)";
-  return fmt::format(sTemplate,
-                     fmt::arg("nosq", int(NOSQUARE)),
-                     fmt::arg("sq", int(SQUARE)),
-                     fmt::arg("bspwn", int(BALL_SPWN)),
-                     fmt::arg("nbl", int(NOBALL)),
-                     fmt::arg("bl", int(BALL)),
-                     fmt::arg("xx", Arena::SquareSize / Arena::Width),
-                     fmt::arg("yy", Arena::SquareSize / Arena::Height),
-                     fmt::arg("bsizex", GlslBallDim.x),
-                     fmt::arg("bsizey", GlslBallDim.y));
+  }
 }
+)";
+  return s;
+}();
 
-static std::string fragShaderSrc()
+static constexpr auto sInstancedVertShader = [] {
+  glsl::FixedString s;
+  s << GlslVersion << sArenaConstants.view() << R"(
+layout(location = 0) in vec2 position;
+layout(location = 1) in uint attribs;
+layout(location = 2) in vec2 corner;
+
+flat out int FData;
+flat out int FType;
+flat out vec2 ObjPos;
+
+void main()
 {
-  static constexpr char sTemplate[] = R"(
-#version 330 core
+  FData = int(attribs >> TypeBits);
+  FType = int(attribs & TypeMask);
+  vec2 pos = 2. * (position / ArenaSize) - vec2(1, 1);
+  ObjPos = pos;
+  // Same sizes as the geometry shader. Other types collapse to a degenerate quad.
+  vec2 size = vec2(0, 0);
+  if (FType == SQUARE) {
+    size = SqSize;
+  } else if (FType == BALL) {
+    size = BallSize;
+  } else if (FType == BALL_SPWN) {
+    size = SqSize * 0.75;
+  }
+  gl_Position = Projection * vec4(pos + corner * size, 0., 1.);
+}
+)";
+  return s;
+}();
 
+static constexpr auto sFragShader = [] {
+  glsl::FixedString s;
+  s << GlslVersion << sArenaConstants.view() << R"(
 out vec4 FragColor;
 
 flat in int FData;
 flat in int FType;
 flat in vec2 ObjPos;
 
-const vec3 Colors[7] = vec3[](
-  vec3(1, 1, 0),
-  vec3(0, 1, 0),
-  vec3(0, 0, 1),
-  vec3(0.29, 0, 0.51),
-  vec3(0.93, 0.51, 0.93),
-  vec3(1, 0, 0),
-  vec3(1, 0.5, 0)
-);
-
-{CharConstants}
-
-const float SqSizeX = {xx:.8f};
-const float SqSizeY = {yy:.8f};
-const float BallSizeX = {bsizex:.8f};
-const float BallSizeY = {bsizey:.8f};
-const float Width = {ww:.8f};
-const float Height = {hh:.8f};
-const int MaxData = 50;
-const vec4 White = vec4(1,1,1,1);
 const vec4 Invisible = vec4(0, 0, 0, 0);
 const float BallFeather = 0.95;
 
-const int NOSQUARE       = {nosq};
-const int SQUARE         = {sq};
-const int BALL_SPWN      = {bspwn};
-const int NOBALL         = {nbl};
-const int BALL           = {bl};
-
-uniform sampler2D CharTexture;
-
-vec4 sampleFont(vec2 fc) {{
-  int digits[4] = int[](-1, -1, -1, -1);
-  int data = FData;
-  int base = 10;
-  int nDigits = max(1, int(ceil(log(float(FData)) / log(10.))));
-  for (int i = nDigits - 1; i > -1; --i) {{
-    digits[i] = data % base;
-    data = (data - digits[i]) / base;
-    base *= 10;
-  }}
-  vec2 bmin = vec2(1, 1);
-  vec2 bmax = vec2(-1,-1);
-  vec2 cur = vec2(0, 0);
-  for (int i = 0; i < nDigits; ++i) {{
-    int d = digits[i];
-    vec2 bearing = CharBearings[d];
-    vec2 size = CharSizes[d];
-    vec2 pos = vec2(cur.x + bearing.x, cur.y - (size.y - bearing.y));
-    bmin.y = min(bmin.y, pos.y);
-    bmin.x = min(bmin.x, pos.x);
-    bmax.y = max(bmax.y, pos.y);
-    bmax.x = max(bmax.x, pos.x);
-    pos += size;
-    bmin.y = min(bmin.y, pos.y);
-    bmin.x = min(bmin.x, pos.x);
-    bmax.y = max(bmax.y, pos.y);
-    bmax.x = max(bmax.x, pos.x);
-    cur.x += CharAdvances[d];
-  }}
-  cur = ObjPos + 0.5 * (bmin - bmax);
-  for (int i = 0; i < nDigits; ++i) {{
-    int d = digits[i];
-    vec2 bearing = CharBearings[d];
-    vec2 size = CharSizes[d];
-    vec2 p1 = vec2(cur.x + bearing.x, cur.y - (size.y - bearing.y));
-    vec2 p2 = p1 + size;
-    if (p1.x <= fc.x && p1.y <= fc.y && fc.x <= p2.x && fc.y <= p2.y) {{
-      fc = fc - p1;
-      fc.x /= p2.x - p1.x;
-      fc.y /= p2.y - p1.y;
-      vec4 tc = CharTxCoords[d];
-      fc.x = tc.x + fc.x * (tc.z - tc.x);
-      fc.y = 1 - (tc.y + fc.y * (tc.w - tc.y));
-      float t = 1 - texture(CharTexture, fc).r;
-      return vec4(t, t, t, 1 - t);
-    }}
-    cur.x += CharAdvances[d];
-  }}
-  return vec4(0, 0, 0, 0);
-}}
-
 void main()
-{{
-  vec2 fc = gl_FragCoord.xy;
-  fc.x /= Width;
-  fc.y /= Height;
+{
+  vec2 fc = (gl_FragCoord.xy - Viewport.xy) / Viewport.zw;
   fc = 2 * fc - vec2(1, 1);
-  if (FType == SQUARE) {{
-    float r = 7. * min(1., float(FData - 1) / float(MaxData - 1));
+  if (FType == SQUARE) {
+    float r = float(Colors.length() - 1) * min(1., float(FData - 1) / float(MaxData - 1));
     int rt = int(ceil(r));
     int lt = int(floor(r));
     r = fract(r);
-    vec4 baseColor = vec4(Colors[lt] * (1. - r) + Colors[rt] * r, 1.);
-    vec4 fontColor = sampleFont(fc);
-    FragColor = fontColor.a * fontColor + (1. - fontColor.a) * baseColor;
-  }} else if (FType == BALL) {{
+    FragColor = vec4(mix(Colors[lt].rgb, Colors[rt].rgb, r), 1.);
+  } else if (FType == BALL) {
     vec2 d = fc - ObjPos;
-    d.x /= BallSizeX;
-    d.y /= BallSizeY;
+    d.x /= BallSize.x;
+    d.y /= BallSize.y;
     float r = min(1, max(0, 1 - sqrt(dot(d, d))));
     r = 1 - pow(1 - r, 5);
     if (r > 0) FragColor = vec4(r, r, r, 1);
     else FragColor = Invisible;
-  }} else if (FType == BALL_SPWN) {{
+  } else if (FType == BALL_SPWN) {
     vec2 d = fc - ObjPos;
     const float s1 = 0.25;
     const float s2 = 0.45;
     const float s3 = 0.55;
-    bool b1 = abs(d.x) < SqSizeX * s1 && abs(d.y) < SqSizeY * s1;
-    bool b2 = abs(d.x) < SqSizeX * s2 && abs(d.y) < SqSizeY * s2;
-    bool b3 = abs(d.x) < SqSizeX * s3 && abs(d.y) < SqSizeY * s3;
-    if (b1) FragColor = White;
+    bool b1 = abs(d.x) < SqSize.x * s1 && abs(d.y) < SqSize.y * s1;
+    bool b2 = abs(d.x) < SqSize.x * s2 && abs(d.y) < SqSize.y * s2;
+    bool b3 = abs(d.x) < SqSize.x * s3 && abs(d.y) < SqSize.y * s3;
+    if (b1) FragColor = SpawnColor;
     else if (b2) FragColor = Invisible;
-    else if (b3) FragColor = White;
+    else if (b3) FragColor = SpawnColor;
     else FragColor = Invisible;
-  }}
+  }
+}
+)";
+  return s;
+}();
+
+static constexpr auto sGlyphVertShader = [] {
+  glsl::FixedString s;
+  s << GlslVersion << sViewBlock.view() << R"(
+layout(location = 0) in vec2 corner;
+layout(location = 1) in vec4 rect;
+layout(location = 2) in vec4 texCoords;
+
+out vec2 TexCoord;
+
+void main()
+{
+  vec2 t = 0.5 * (corner + vec2(1, 1));
+  vec2 pos = mix(rect.xy, rect.zw, t);
+  pos = 2. * (pos / ArenaSize) - vec2(1, 1);
+  TexCoord = mix(texCoords.xy, texCoords.zw, t);
+  // In front of the squares.
+  gl_Position = Projection * vec4(pos, -0.5, 1.);
+}
+)";
+  return s;
+}();
+
+static std::string glyphFragShaderSrc(glm::vec3 color, Font font)
+{
+  static constexpr char sTemplate[] = R"(
+#version 330 core
+
+in vec2 TexCoord;
+out vec4 FragColor;
+
+uniform sampler2D CharTexture;
+
+{coverage}
+
+void main()
+{{
+  FragColor = vec4({r:.4f}, {g:.4f}, {b:.4f}, coverage());
 }}
 )";
+  static constexpr char sBitmap[] = R"(
+float coverage()
+{
+  return texture(CharTexture, TexCoord).r;
+})";
+  // The outline is at 0.5. Blending over about a pixel either side of it, however much
+  // the distance changes per pixel at the current scale, keeps the edges smooth.
+  static constexpr char sSdf[] = R"(
+float coverage()
+{
+  float d = texture(CharTexture, TexCoord).r;
+  float w = max(0.7 * fwidth(d), 1e-4);
+  return smoothstep(0.5 - w, 0.5 + w, d);
+})";
   return fmt::format(sTemplate,
-                     fmt::arg("nosq", int(NOSQUARE)),
-                     fmt::arg("sq", int(SQUARE)),
-                     fmt::arg("bspwn", int(BALL_SPWN)),
-                     fmt::arg("nbl", int(NOBALL)),
-                     fmt::arg("bl", int(BALL)),
-                     fmt::arg("bsizex", GlslBallDim.x),
-                     fmt::arg("bsizey", GlslBallDim.y),
-                     fmt::arg("ww", Arena::Width),
-                     fmt::arg("hh", Arena::Height),
-                     fmt::arg("xx", Arena::SquareSize / Arena::Width),
-                     fmt::arg("yy", Arena::SquareSize / Arena::Height),
-                     fmt::arg("CharConstants", CharAtlas::get().glslConstants()));
+                     fmt::arg("coverage", font == Font::Sdf ? sSdf : sBitmap),
+                     fmt::arg("r", color[0]),
+                     fmt::arg("g", color[1]),
+                     fmt::arg("b", color[2]));
 }
 
 static void checkShaderCompilation(uint32_t id, uint32_t type)
@@ -495,7 +642,7 @@ static void checkShaderCompilation(uint32_t id, uint32_t type)
   }
 }
 
-static void checkShaderLinking(uint32_t progId)
+static bool checkShaderLinking(uint32_t progId)
 {
   int success;
   glGetProgramiv(progId, GL_LINK_STATUS, &success);
@@ -504,50 +651,219 @@ static void checkShaderLinking(uint32_t progId)
     glGetProgramInfoLog(progId, 1024, NULL, infoLog);
     logger().error("Error linking shader program:\n{}", infoLog);
   }
+  return success;
+}
+
+// GLSL 3.30 can't give uniform blocks a binding in the source.
+static void bindUniformBlocks(uint32_t program)
+{
+  GLuint index = glGetUniformBlockIndex(program, "View");
+  if (index != GL_INVALID_INDEX) {
+    GL_CALL(glUniformBlockBinding(program, index, Screen::ViewBinding));
+  }
+  index = glGetUniformBlockIndex(program, "Board");
+  if (index != GL_INVALID_INDEX) {
+    GL_CALL(glUniformBlockBinding(program, index, GLSink::BoardBinding));
+  }
+}
+
+static std::optional<std::filesystem::path> sShaderCacheDir;
+
+void setShaderCacheDir(std::filesystem::path dir)
+{
+  sShaderCacheDir = std::move(dir);
+}
+
+const std::filesystem::path& shaderCacheDir()
+{
+  if (!sShaderCacheDir) {
+    const char*     env = std::getenv("CABBAGE_SHADER_CACHE");
+    std::error_code err;
+    auto            tmp = std::filesystem::temp_directory_path(err);
+    sShaderCacheDir     = env ? std::filesystem::path(env) : tmp / "cabbage-shaders";
+  }
+  return *sShaderCacheDir;
+}
+
+// Program binaries are only valid for the driver that produced them, and the driver is
+// free to reject them anyway, so they are only ever a shortcut past the compilation.
+static bool canCacheProgram()
+{
+  GLint nFormats = 0;
+  if (GLEW_ARB_get_program_binary) {
+    GL_CALL(glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &nFormats));
+  }
+  return nFormats > 0 && !shaderCacheDir().empty();
+}
+
+// FNV-1a of the sources and the driver strings. A new driver gets new cache entries.
+static uint64_t programKey(std::initializer_list<std::string_view> sources)
+{
+  uint64_t h   = 0xcbf29ce484222325;
+  auto     mix = [&h](std::string_view str) {
+    for (char c : str) {
+      h = (h ^ uint8_t(c)) * 0x100000001b3;
+    }
+    // Separate the strings, so moving text from one to the next changes the key.
+    h = (h ^ 0xff) * 0x100000001b3;
+  };
+  for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+    const GLubyte* str = glGetString(name);
+    mix(str ? reinterpret_cast<const char*>(str) : "");
+  }
+  for (std::string_view src : sources) {
+    mix(src);
+  }
+  return h;
+}
+
+static std::filesystem::path programCachePath(uint64_t key)
+{
+  return shaderCacheDir() / fmt::format("{:016x}.bin", key);
+}
+
+// Each file holds the key, the binary format and the binary.
+static constexpr uint32_t ProgramCacheMagic = 0x48534243;  // "CBSH"
+
+static bool loadProgramBinary(uint32_t program, uint64_t key)
+{
+  auto          path = programCachePath(key);
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    return false;
+  }
+  uint32_t magic  = 0;
+  uint64_t stored = 0;
+  GLenum   format = 0;
+  uint32_t size   = 0;
+  in.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+  in.read(reinterpret_cast<char*>(&stored), sizeof(stored));
+  in.read(reinterpret_cast<char*>(&format), sizeof(format));
+  in.read(reinterpret_cast<char*>(&size), sizeof(size));
+  std::vector<char> binary(in ? size : 0);
+  in.read(binary.data(), std::streamsize(binary.size()));
+  GLint linked = GL_FALSE;
+  if (in && magic == ProgramCacheMagic && stored == key) {
+    // A rejected binary raises an error, which is expected, so it goes unchecked.
+    glProgramBinary(program, format, binary.data(), GLsizei(binary.size()));
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    clear_errors();
+  }
+  if (!linked) {
+    // Stale or damaged. It is written again after the compilation.
+    logger().warn("Discarding the cached shader program '{}'.", path.string());
+    in.close();
+    std::error_code err;
+    std::filesystem::remove(path, err);
+    return false;
+  }
+  return true;
 }
 
-Shader::Shader()
+static void saveProgramBinary(uint32_t program, uint64_t key)
 {
+  GLint size = 0;
+  GL_CALL(glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size));
+  if (size <= 0) {
+    return;
+  }
+  std::vector<char> binary(size);
+  GLenum            format = 0;
+  GL_CALL(glGetProgramBinary(program, size, &size, &format, binary.data()));
+  std::error_code err;
+  std::filesystem::create_directories(shaderCacheDir(), err);
+  // Written to the side and renamed, so a crash or another instance of the game never
+  // leaves a partial file at the real path.
+  auto path = programCachePath(key);
+  auto temp = path;
+  temp += fmt::format(".{}", std::chrono::steady_clock::now().time_since_epoch().count());
+  {
+    std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+    uint32_t      usize = uint32_t(size);
+    uint32_t      magic = ProgramCacheMagic;
+    out.write(reinterpret_cast<const char*>(&magic), sizeof(magic));
+    out.write(reinterpret_cast<const char*>(&key), sizeof(key));
+    out.write(reinterpret_cast<const char*>(&format), sizeof(format));
+    out.write(reinterpret_cast<const char*>(&usize), sizeof(usize));
+    out.write(binary.data(), size);
+    if (!out) {
+      out.close();
+      std::filesystem::remove(temp, err);
+      return;
+    }
+  }
+  std::filesystem::rename(temp, path, err);
+  if (err) {
+    std::filesystem::remove(temp, err);
+  }
+}
+
+Shader::Shader(Pipeline pipeline)
+    : Shader(std::string(pipeline == Pipeline::Instanced ? sInstancedVertShader.view()
+                                                         : sVertShader.view()),
+             std::string(pipeline == Pipeline::Geometry ? sGeoShader.view()
+                                                        : std::string_view()),
+             std::string(sFragShader.view()))
+{}
+
+Shader::Shader(const std::string& vertSrc,
+               const std::string& geoSrc,
+               const std::string& fragSrc)
+{
+  mId                 = glCreateProgram();
+  const bool useCache = canCacheProgram();
+  uint64_t   key      = 0;
+  if (useCache) {
+    key = programKey({vertSrc, geoSrc, fragSrc});
+    if (loadProgramBinary(mId, key)) {
+      bindUniformBlocks(mId);
+      return;
+    }
+  }
   uint32_t vsId = 0;
   {  // Compile vertex shader.
-    std::string src  = vertShaderSrc();
     vsId             = glCreateShader(GL_VERTEX_SHADER);
-    const char* cstr = src.c_str();
+    const char* cstr = vertSrc.c_str();
     GL_CALL(glShaderSource(vsId, 1, &cstr, nullptr));
     GL_CALL(glCompileShader(vsId));
     checkShaderCompilation(vsId, GL_VERTEX_SHADER);
   }
   uint32_t gsId = 0;
-  {  // Compile geometry shader.
-    std::string src  = geoShaderSrc();
+  if (!geoSrc.empty()) {  // Compile geometry shader.
     gsId             = glCreateShader(GL_GEOMETRY_SHADER);
-    const char* cstr = src.c_str();
+    const char* cstr = geoSrc.c_str();
     GL_CALL(glShaderSource(gsId, 1, &cstr, nullptr));
     GL_CALL(glCompileShader(gsId));
     checkShaderCompilation(gsId, GL_GEOMETRY_SHADER);
   }
   uint32_t fsId = 0;
   {  // Compile fragment shader.
-    std::string src  = fragShaderSrc();
     fsId             = glCreateShader(GL_FRAGMENT_SHADER);
-    const char* cstr = src.c_str();
+    const char* cstr = fragSrc.c_str();
     GL_CALL(glShaderSource(fsId, 1, &cstr, nullptr));
     GL_CALL(glCompileShader(fsId));
     checkShaderCompilation(fsId, GL_FRAGMENT_SHADER);
   }
   // Link
-  mId = glCreateProgram();
   GL_CALL(glAttachShader(mId, vsId));
-  GL_CALL(glAttachShader(mId, gsId));
+  if (gsId) {
+    GL_CALL(glAttachShader(mId, gsId));
+  }
   GL_CALL(glAttachShader(mId, fsId));
+  if (useCache) {
+    GL_CALL(glProgramParameteri(mId, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE));
+  }
   GL_CALL(glLinkProgram(mId));
-  checkShaderLinking(mId);
+  if (checkShaderLinking(mId) && useCache) {
+    saveProgramBinary(mId, key);
+  }
+  bindUniformBlocks(mId);
   // Delete shaders.
   GL_CALL(glDeleteShader(vsId));
-  GL_CALL(glDeleteShader(gsId));
+  if (gsId) {
+    GL_CALL(glDeleteShader(gsId));
+  }
   GL_CALL(glDeleteShader(fsId));
-  // Bind texture for text rendering.
-  CharAtlas::get().bind();
 }
 
 void Shader::use() const
@@ -568,4 +884,366 @@ Shader::~Shader()
   free();
 }
 
+// Corners of the unit quad, drawn as a triangle strip.
+static constexpr std::array<glm::vec2, 4> sQuad = {
+  {{-1.f, -1.f}, {1.f, -1.f}, {-1.f, 1.f}, {1.f, 1.f}}};
+
+TextBatch::TextBatch(glm::vec3 color, Font font)
+    : mFont(font)
+    , mShader(std::string(sGlyphVertShader.view()),
+              std::string(),
+              glyphFragShaderSrc(color, font))
+{
+  GL_CALL(glGenVertexArrays(1, &mVao));
+  GL_CALL(glGenBuffers(1, &mVbo));
+  GL_CALL(glGenBuffers(1, &mQuadVbo));
+  GL_CALL(glBindVertexArray(mVao));
+  GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, mQuadVbo));
+  GL_CALL(glBufferData(GL_ARRAY_BUFFER, sizeof(sQuad), sQuad.data(), GL_STATIC_DRAW));
+  GL_CALL(glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), nullptr));
+  GL_CALL(glEnableVertexAttribArray(0));
+  GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, mVbo));
+  GL_CALL(glVertexAttribPointer(
+    1, 4, GL_FLOAT, GL_FALSE, sizeof(Glyph), (void*)offsetof(Glyph, mRect)));
+  GL_CALL(glEnableVertexAttribArray(1));
+  GL_CALL(glVertexAttribDivisor(1, 1));
+  GL_CALL(glVertexAttribPointer(
+    2, 4, GL_FLOAT, GL_FALSE, sizeof(Glyph), (void*)offsetof(Glyph, mTexCoords)));
+  GL_CALL(glEnableVertexAttribArray(2));
+  GL_CALL(glVertexAttribDivisor(2, 1));
+  GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+  GL_CALL(glBindVertexArray(0));
+}
+
+TextBatch::~TextBatch()
+{
+  free();
+}
+
+void TextBatch::clear()
+{
+  mGlyphs.clear();
+  mDirty = true;
+}
+
+void TextBatch::addNumber(uint32_t value, glm::vec2 center)
+{
+  const auto& atlas = CharAtlas::get(mFont);
+  // Digits, most significant first.
+  std::array<int, 10> digits;
+  int                 nDigits = 0;
+  do {
+    digits[nDigits++] = int(value % 10);
+    value /= 10;
+  } while (value);
+  std::reverse(digits.begin(), digits.begin() + nDigits);
+  // Lay the glyphs out from the origin, then shift them to center their bounds.
+  size_t    first = mGlyphs.size();
+  glm::vec2 bmin  = glm::vec2(std::numeric_limits<float>::max());
+  glm::vec2 bmax  = glm::vec2(std::numeric_limits<float>::lowest());
+  float     cur   = 0.f;
+  for (int i = 0; i < nDigits; ++i) {
+    int       d       = digits[i];
+    glm::vec2 bearing = atlas.bearing(d);
+    glm::vec2 size    = atlas.size(d);
+    glm::vec2 p1      = {cur + bearing.x, bearing.y - size.y};
+    glm::vec2 p2      = p1 + size;
+    bmin              = glm::min(bmin, p1);
+    bmax              = glm::max(bmax, p2);
+    mGlyphs.push_back({glm::vec4(p1, p2), atlas.textureCoords(d)});
+    cur += atlas.advance(d);
+  }
+  glm::vec2 offset = center - 0.5f * (bmin + bmax);
+  for (size_t i = first; i < mGlyphs.size(); ++i) {
+    auto& rect = mGlyphs[i].mRect;
+    rect[0] += offset.x;
+    rect[1] += offset.y;
+    rect[2] += offset.x;
+    rect[3] += offset.y;
+  }
+  mDirty = true;
+}
+
+void TextBatch::draw()
+{
+  if (mGlyphs.empty()) {
+    return;
+  }
+  GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, mVbo));
+  if (mGlyphs.size() > mCapacity) {
+    mCapacity = std::max(mGlyphs.size(), 2 * mCapacity);
+    GL_CALL(glBufferData(
+      GL_ARRAY_BUFFER, sizeof(Glyph) * mCapacity, nullptr, GL_DYNAMIC_DRAW));
+    mDirty = true;
+  }
+  if (mDirty) {
+    GL_CALL(glBufferSubData(
+      GL_ARRAY_BUFFER, 0, sizeof(Glyph) * mGlyphs.size(), mGlyphs.data()));
+    mDirty = false;
+  }
+  GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+  mShader.use();
+  CharAtlas::get(mFont).bind();
+  GL_CALL(glBindVertexArray(mVao));
+  GL_CALL(glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, GLsizei(mGlyphs.size())));
+}
+
+void TextBatch::free()
+{
+  if (mVao) {
+    GL_CALL(glDeleteVertexArrays(1, &mVao));
+    mVao = 0;
+  }
+  if (mVbo) {
+    GL_CALL(glDeleteBuffers(1, &mVbo));
+    mVbo = 0;
+  }
+  if (mQuadVbo) {
+    GL_CALL(glDeleteBuffers(1, &mQuadVbo));
+    mQuadVbo = 0;
+  }
+  mShader.free();
+}
+
+// Points the vertex attributes at the vertex buffer bound to GL_ARRAY_BUFFER, starting
+// at the vertex `first`. The divisor is 1 for the instanced pipeline.
+static void initVertexAttributes(size_t first, uint32_t divisor)
+{
+  static constexpr size_t stride       = sizeof(Vertex);
+  const size_t            base         = first * stride;
+  const void*             posOffset    = (void*)(base + offsetof(Vertex, mPos));
+  const void*             packedOffset = (void*)(base + offsetof(Vertex, mPacked));
+  GL_CALL(glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, stride, posOffset));
+  GL_CALL(glEnableVertexAttribArray(0));
+  GL_CALL(glVertexAttribDivisor(0, divisor));
+  GL_CALL(glVertexAttribIPointer(1, 1, GL_UNSIGNED_INT, stride, packedOffset));
+  GL_CALL(glEnableVertexAttribArray(1));
+  GL_CALL(glVertexAttribDivisor(1, divisor));
+}
+
+void GLSink::initAttributes(size_t first) const
+{
+  initVertexAttributes(first, mPipeline == Pipeline::Instanced ? 1 : 0);
+}
+
+void GLSink::initQuad() const
+{
+  GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, mQuadVbo));
+  GL_CALL(glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), nullptr));
+  GL_CALL(glEnableVertexAttribArray(2));
+}
+
+GLSink::GLSink(Pipeline pipeline, Font font)
+    : mPipeline(pipeline)
+    , mShader(pipeline)
+    , mLabels(glm::vec3 {0.f, 0.f, 0.f}, font)
+{
+  if (mPipeline == Pipeline::Instanced) {
+    GL_CALL(glGenBuffers(1, &mQuadVbo));
+    GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, mQuadVbo));
+    GL_CALL(glBufferData(GL_ARRAY_BUFFER, sizeof(sQuad), sQuad.data(), GL_STATIC_DRAW));
+  }
+  static constexpr size_t capacity = Arena::NGrid + Arena::NMaxBalls;
+  // Create and bind the vertex array.
+  GL_CALL(glGenVertexArrays(1, &mVao));
+  GL_CALL(glGenBuffers(1, &mVbo));
+  bind();
+  // Allocate storage. The arena uploads its objects when it is constructed.
+  GL_CALL(
+    glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * capacity, nullptr, GL_DYNAMIC_DRAW));
+  // Initialize the attributes.
+  initAttributes(0);
+  if (mPipeline == Pipeline::Instanced) {
+    initQuad();
+  }
+  unbind();
+  if (GLEW_ARB_buffer_storage) {
+    initStream();
+  }
+  else {
+    logger().info("Persistent buffer mapping is not supported. Balls will be uploaded.");
+  }
+  GL_CALL(glGenBuffers(1, &mBoardUbo));
+  GL_CALL(glBindBuffer(GL_UNIFORM_BUFFER, mBoardUbo));
+  GL_CALL(glBufferData(GL_UNIFORM_BUFFER, sizeof(BoardBlock), nullptr, GL_DYNAMIC_DRAW));
+  GL_CALL(glBindBuffer(GL_UNIFORM_BUFFER, 0));
+  setStyle(mStyle);
+}
+
+void GLSink::setStyle(const BoardStyle& style)
+{
+  mStyle           = style;
+  BoardBlock block = {};
+  block.mMaxData   = std::max(style.mMaxData, 2);
+  for (size_t i = 0; i < BoardStyle::NColors; ++i) {
+    block.mColors[i] = glm::vec4(style.mColors[i], 1.f);
+  }
+  block.mSpawnColor = glm::vec4(style.mSpawnColor, 1.f);
+  GL_CALL(glBindBuffer(GL_UNIFORM_BUFFER, mBoardUbo));
+  GL_CALL(glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(block), &block));
+  GL_CALL(glBindBuffer(GL_UNIFORM_BUFFER, 0));
+}
+
+void GLSink::initStream()
+{
+  static constexpr GLbitfield flags =
+    GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+  static constexpr GLsizeiptr size = sizeof(Vertex) * Arena::NMaxBalls * NFrames;
+  GL_CALL(glGenVertexArrays(1, &mStreamVao));
+  GL_CALL(glGenBuffers(1, &mStreamVbo));
+  GL_CALL(glBindVertexArray(mStreamVao));
+  GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, mStreamVbo));
+  GL_CALL(glBufferStorage(GL_ARRAY_BUFFER, size, nullptr, flags));
+  GL_CALL(mStream =
+            static_cast<Vertex*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags)));
+  initAttributes(0);
+  if (mPipeline == Pipeline::Instanced) {
+    initQuad();
+  }
+  unbind();
+}
+
+std::span<Vertex> GLSink::streamBalls()
+{
+  if (!mStream) {
+    return {};
+  }
+  mFrame = (mFrame + 1) % NFrames;
+  // Wait for the GPU to finish the frame that last read from this part of the ring.
+  // With three frames in flight this almost never blocks.
+  GLsync& fence = mFences[mFrame];
+  if (fence) {
+    while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) ==
+           GL_TIMEOUT_EXPIRED) {}
+    GL_CALL(glDeleteSync(fence));
+    fence = nullptr;
+  }
+  return std::span<Vertex>(mStream + mFrame * Arena::NMaxBalls, Arena::NMaxBalls);
+}
+
+void GLSink::upload(size_t first, std::span<const Vertex> vertices)
+{
+  trace::Scope trace("GLSink::upload");
+  if (first < Arena::NGrid) {
+    // Keep a copy of the squares to lay out their labels from.
+    size_t n = std::min(vertices.size(), Arena::NGrid - first);
+    std::copy_n(vertices.begin(), n, mSquares.begin() + first);
+    mLabelsDirty = true;
+  }
+  bind();
+  GL_CALL(glBufferSubData(
+    GL_ARRAY_BUFFER, sizeof(Vertex) * first, vertices.size_bytes(), vertices.data()));
+  unbind();
+}
+
+void GLSink::drawRange(uint32_t vao, uint32_t vbo, size_t first, size_t count) const
+{
+  if (count == 0) {
+    return;
+  }
+  GL_CALL(glBindVertexArray(vao));
+  if (mPipeline == Pipeline::Instanced) {
+    // There is no base instance in GL 3.3, so the attributes are pointed at the first
+    // instance instead.
+    GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, vbo));
+    initAttributes(first);
+    GL_CALL(glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, GLsizei(count)));
+  }
+  else {
+    GL_CALL(glDrawArrays(GL_POINTS, GLint(first), GLsizei(count)));
+  }
+}
+
+void GLSink::draw(size_t nSquares, size_t nBalls)
+{
+  trace::Scope trace("GLSink::draw");
+  // Another sink may have taken the binding since.
+  GL_CALL(glBindBufferBase(GL_UNIFORM_BUFFER, BoardBinding, mBoardUbo));
+  mShader.use();
+  drawRange(mVao, mVbo, 0, nSquares);
+  if (mStream) {
+    drawRange(mStreamVao, mStreamVbo, mFrame * Arena::NMaxBalls, nBalls);
+    GLsync& fence = mFences[mFrame];
+    if (fence) {
+      GL_CALL(glDeleteSync(fence));
+    }
+    GL_CALL(fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+  }
+  else {
+    drawRange(mVao, mVbo, Arena::NGrid, nBalls);
+  }
+  // The labels only need to be laid out again when the squares change.
+  if (mLabelsDirty || nSquares != mNumLabelled) {
+    mLabels.clear();
+    for (size_t i = 0; i < nSquares; ++i) {
+      const auto& sq = mSquares[i];
+      if (sq.type() == SQUARE) {
+        mLabels.addNumber(uint32_t(sq.data()), sq.mPos);
+      }
+    }
+    mNumLabelled = nSquares;
+    mLabelsDirty = false;
+  }
+  mLabels.draw();
+}
+
+void GLSink::free()
+{
+  for (GLsync& fence : mFences) {
+    if (fence) {
+      GL_CALL(glDeleteSync(fence));
+      fence = nullptr;
+    }
+  }
+  if (mStream) {
+    GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, mStreamVbo));
+    GL_CALL(glUnmapBuffer(GL_ARRAY_BUFFER));
+    GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+    mStream = nullptr;
+  }
+  if (mStreamVao) {
+    GL_CALL(glDeleteVertexArrays(1, &mStreamVao));
+    mStreamVao = 0;
+  }
+  if (mStreamVbo) {
+    GL_CALL(glDeleteBuffers(1, &mStreamVbo));
+    mStreamVbo = 0;
+  }
+  if (mVao) {
+    GL_CALL(glDeleteVertexArrays(1, &mVao));
+    mVao = 0;
+  }
+  if (mVbo) {
+    GL_CALL(glDeleteBuffers(1, &mVbo));
+    mVbo = 0;
+  }
+  if (mQuadVbo) {
+    GL_CALL(glDeleteBuffers(1, &mQuadVbo));
+    mQuadVbo = 0;
+  }
+  if (mBoardUbo) {
+    GL_CALL(glDeleteBuffers(1, &mBoardUbo));
+    mBoardUbo = 0;
+  }
+  mShader.free();
+  mLabels.free();
+}
+
+GLSink::~GLSink()
+{
+  free();
+}
+
+void GLSink::bind() const
+{
+  GL_CALL(glBindVertexArray(mVao));
+  GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, mVbo));
+}
+
+void GLSink::unbind() const
+{
+  GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+  GL_CALL(glBindVertexArray(0));
+}
+
 }  // namespace view
@@ -2,6 +2,11 @@
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
+#include <Game.h>
+#include <array>
+#include <filesystem>
+#include <string>
+#include <vector>
 #include <spdlog/spdlog.h>
 
 #ifdef WIN32
@@ -39,11 +44,67 @@ namespace view {
 spdlog::logger& logger();
 bool            log_errors(const char* function, const char* file, uint line);
 void            clear_errors();
+// Opens the window and makes its OpenGL context current. A hidden window still has a
+// context to render offscreen with.
+int initGL(GLFWwindow*& window, bool visible = true);
+// Fits the arena into the framebuffer of the window, keeping its aspect ratio, as the
+// window is resized. The arena can also be drawn offscreen at a fraction of that
+// resolution and upscaled, to save fill rate. It owns the View uniform block that every
+// shader projects with, which is all that changes with the size of the window.
+class Screen
+{
+public:
+  static constexpr uint32_t ViewBinding = 0;  // Of the View uniform block.
+
+  explicit Screen(GLFWwindow* window, float renderScale = 1.f);
+  ~Screen();
+  // Binds and clears the framebuffer to draw the frame into.
+  void begin() const;
+  // Upscales the frame into the window, when drawing offscreen.
+  void end() const;
+  // Arena coordinates of a point in window coordinates, like the cursor position.
+  glm::vec2 toArena(glm::vec2 point) const;
+  void      free();
+  Screen(const Screen&) = delete;
+  Screen(Screen&&)      = delete;
+
+private:
+  static void onResize(GLFWwindow* window, int width, int height);
+  void        resize(int width, int height);
+
+  GLFWwindow* mWindow;
+  float       mRenderScale;
+  glm::ivec2  mSize   = {0, 0};  // Of the framebuffer of the window.
+  glm::ivec2  mOrigin = {0, 0};  // Of the arena in the framebuffer.
+  glm::ivec2  mExtent = {0, 0};
+  glm::ivec2  mTarget = {0, 0};  // Of the offscreen framebuffer.
+  uint32_t    mUbo    = 0;
+  uint32_t    mFbo    = 0;
+  uint32_t    mColor  = 0;
+  uint32_t    mDepth  = 0;
+};
+
+// Where linked shader programs are cached between runs. It defaults to the
+// CABBAGE_SHADER_CACHE environment variable, or a directory in the system temp
+// directory. An empty path turns the cache off.
+void                         setShaderCacheDir(std::filesystem::path dir);
+const std::filesystem::path& shaderCacheDir();
+
+// How the point per object is expanded into a quad.
+enum class Pipeline
+{
+  Geometry,   // A geometry shader emits the quad.
+  Instanced,  // A unit quad is instanced once per object.
+};
 
 class Shader
 {
 public:
-  Shader();
+  explicit Shader(Pipeline pipeline = Pipeline::Geometry);
+  // Leave the geometry shader source empty for a program without one.
+  Shader(const std::string& vertSrc,
+         const std::string& geoSrc,
+         const std::string& fragSrc);
   ~Shader();
   void use() const;
   void free();
@@ -54,4 +115,138 @@ private:
   uint32_t mId = 0;
 };
 
+// What the character atlas stores.
+enum class Font
+{
+  Bitmap,  // Coverage, sharp only at the size it was rasterized for.
+  Sdf,     // Signed distance to the outline, sharp at any size.
+};
+
+// The digits rasterized into one texture at build time. Everything that draws text
+// shares the atlases from get(), constructing another one uploads the texture again.
+// Metrics are in pixels at the size of the labels, whatever the resolution of the
+// texture.
+class CharAtlas
+{
+public:
+  static constexpr size_t NChars = 10;  // Just the numerical characters.
+
+  explicit CharAtlas(Font font);
+  ~CharAtlas();
+  void              bind() const;
+  static CharAtlas& get(Font font);
+  // Texture coordinates at the bottom left and the top right of the glyph.
+  const glm::vec4& textureCoords(int digit) const { return mTexCoords[digit]; }
+  const glm::vec2& size(int digit) const { return mSizes[digit]; }
+  const glm::vec2& bearing(int digit) const { return mBearings[digit]; }
+  float            advance(int digit) const { return mAdvances[digit]; }
+  CharAtlas(const CharAtlas&) = delete;
+  CharAtlas(CharAtlas&&)      = delete;
+
+private:
+  std::array<glm::vec2, NChars> mBearings;
+  std::array<glm::vec2, NChars> mSizes;
+  std::array<float, NChars>     mAdvances;
+  std::array<glm::vec4, NChars> mTexCoords;
+  uint32_t                      mTexId = 0;
+};
+
+// Glyphs from the character atlas, laid out on the CPU and drawn as textured instances.
+class TextBatch
+{
+public:
+  explicit TextBatch(glm::vec3 color = {0.f, 0.f, 0.f}, Font font = Font::Sdf);
+  ~TextBatch();
+  void clear();
+  // Adds the decimal digits of the value, centered at the given arena coordinates.
+  void addNumber(uint32_t value, glm::vec2 center);
+  void draw();
+  void free();
+  TextBatch(const TextBatch&) = delete;
+  TextBatch(TextBatch&&)      = delete;
+
+private:
+  struct Glyph
+  {
+    glm::vec4 mRect;       // Min and max corners in arena coordinates.
+    glm::vec4 mTexCoords;  // Texture coordinates at the min and max corners.
+  };
+
+  Font               mFont;
+  Shader             mShader;
+  std::vector<Glyph> mGlyphs;
+  uint32_t           mVao      = 0;
+  uint32_t           mVbo      = 0;
+  uint32_t           mQuadVbo  = 0;
+  size_t             mCapacity = 0;
+  bool               mDirty    = false;
+};
+
+// The colors of the arena, read by the shaders from the Board uniform block. Changing
+// them takes a single upload, the shaders stay as they are. Sizes are not part of it,
+// they have to match the physics.
+struct BoardStyle
+{
+  static constexpr size_t NColors = 7;
+
+  // Squares go through the colors as their data goes from 1 to mMaxData, and keep the
+  // last one past it.
+  int32_t                        mMaxData    = 50;
+  std::array<glm::vec3, NColors> mColors     = {{{1.f, 1.f, 0.f},
+                                                 {0.f, 1.f, 0.f},
+                                                 {0.f, 0.f, 1.f},
+                                                 {0.29f, 0.f, 0.51f},
+                                                 {0.93f, 0.51f, 0.93f},
+                                                 {1.f, 0.f, 0.f},
+                                                 {1.f, 0.5f, 0.f}}};
+  glm::vec3                      mSpawnColor = {1.f, 1.f, 1.f};
+};
+
+// Draws the arena objects from a vertex buffer, and the labels of the squares.
+class GLSink : public RenderSink
+{
+public:
+  static constexpr uint32_t BoardBinding = 1;  // Of the Board uniform block.
+
+  explicit GLSink(Pipeline pipeline = Pipeline::Geometry, Font font = Font::Sdf);
+  ~GLSink();
+  void              setStyle(const BoardStyle& style);
+  const BoardStyle& style() const { return mStyle; }
+  void              upload(size_t first, std::span<const Vertex> vertices) override;
+  std::span<Vertex> streamBalls() override;
+  void              draw(size_t nSquares, size_t nBalls) override;
+  void              free();
+  GLSink(const GLSink&) = delete;
+  GLSink(GLSink&&)      = delete;
+
+private:
+  // Number of frames the ball stream is buffered over.
+  static constexpr uint32_t NFrames = 3;
+
+  void initStream();
+  void initAttributes(size_t first) const;
+  void initQuad() const;
+  void drawRange(uint32_t vao, uint32_t vbo, size_t first, size_t count) const;
+  void bind() const;
+  void unbind() const;
+
+  Pipeline                         mPipeline;
+  BoardStyle                       mStyle;
+  uint32_t                         mBoardUbo = 0;
+  Shader                           mShader;
+  TextBatch                        mLabels;
+  std::array<Vertex, Arena::NGrid> mSquares;  // Copy of the squares, for the labels.
+  size_t                           mNumLabelled = 0;
+  bool                             mLabelsDirty = true;
+  uint32_t                         mVao         = 0;
+  uint32_t                         mVbo         = 0;
+  uint32_t                         mQuadVbo     = 0;
+  // Persistently mapped ring of ball vertices, if the driver supports it.
+  uint32_t                    mStreamVao = 0;
+  uint32_t                    mStreamVbo = 0;
+  Vertex*                     mStream    = nullptr;
+  std::array<GLsync, NFrames> mFences    = {};
+  uint32_t                    mFrame     = 0;
+};
+
 }  // namespace view
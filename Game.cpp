@@ -1,127 +1,220 @@
-#include <GLUtil.h>
+#include <Board.h>
 #include <Game.h>
+#include <GridPhysics.h>
+#include <Random.h>
+#include <Simd.h>
+#include <Trace.h>
 #include <box2d/b2_body.h>
 #include <box2d/b2_math.h>
 #include <box2d/b2_polygon_shape.h>
 #include <box2d/box2d.h>
 #include <fmt/core.h>
 #include <algorithm>
+#include <bit>
+#include <cmath>
 #include <cstdint>
+#include <numbers>
+#include <numeric>
+#include <type_traits>
 
 Object::Object(Type type)
     : mType(type)
 {}
 
-static glm::vec2 calcSquareShape(int si, std::array<b2Vec2, 4>& verts)
-{
-  glm::vec2 center =
-    Arena::CellSize *
-    (glm::vec2 {0.5f, 0.5f} + glm::vec2 {float(si % Arena::NX), float(si / Arena::NX)});
-  glm::vec2                y = {0.f, 0.5f * Arena::SquareSize};
-  glm::vec2                x = {0.5f * Arena::SquareSize, 0.f};
-  std::array<glm::vec2, 4> temp;
-  temp[0] = center - x - y;
-  temp[1] = center + x - y;
-  temp[2] = center + x + y;
-  temp[3] = center - x + y;
-  std::transform(temp.begin(), temp.end(), verts.begin(), [](glm::vec2 v) {
+static void calcSquareShape(uint32_t si, std::array<b2Vec2, 4>& verts)
+{
+  const auto& corners = board::Corners[si];
+  std::transform(corners.begin(), corners.end(), verts.begin(), [](glm::vec2 v) {
     return b2Vec2(v[0], v[1]);
   });
-  return center;
 }
 
 Object::Object() {}
 
-Arena::Arena(b2World& world)
+static Type sampleRowType(uint32_t random)
+{
+  static constexpr uint32_t Total =
+    std::accumulate(Arena::RowWeights.begin(), Arena::RowWeights.end(), 0u);
+  static_assert(std::has_single_bit(Total), "Row weights must add up to a power of two");
+  static constexpr int Bits = std::bit_width(Total) - 1;
+  uint32_t             x    = random >> (32 - Bits);
+  for (uint32_t t = 0; t + 1 < Arena::RowWeights.size(); ++t) {
+    if (x < Arena::RowWeights[t]) {
+      return Type(t);
+    }
+    x -= Arena::RowWeights[t];
+  }
+  return Type(Arena::RowWeights.size() - 1);
+}
+
+Arena::Arena(b2World& world, RenderSink* sink, uint32_t seed, Physics physics)
     : mWorld(world)
+    , mSink(sink)
+    , mPhysics(physics)
+    , mSeed(seed)
 {
+  if (mPhysics == Physics::Grid) {
+    mGridPhysics = std::make_unique<GridPhysics>();
+  }
   auto squares = getSquares();
   std::fill(squares.begin(), squares.end(), Object(NOSQUARE));
   auto balls = getBalls();
   std::fill(balls.begin(), balls.end(), Object(NOBALL));
   initGridBody();
+  initWalls();
   auto& grid = *mGrid;
   for (uint32_t i = 0; i < squares.size(); ++i) {
     auto&                 dst = squares[i];
     b2PolygonShape        shape;
     std::array<b2Vec2, 4> verts;
-    dst.mPos = calcSquareShape(i, verts);
+    calcSquareShape(i, verts);
     shape.Set(verts.data(), int(verts.size()));
-    dst.mFixture                        = grid.CreateFixture(&shape, 0.f);
-    dst.mFixture->GetUserData().pointer = reinterpret_cast<uintptr_t>(&dst);
-  }
-  for (uint32_t i = 0; i < balls.size(); ++i) {
-    auto&     dst = balls[i];
-    b2BodyDef def;
-    def.type   = b2_dynamicBody;
-    def.bullet = true;
-    def.position.Set(0.f, 0.f);
-    def.userData.pointer = reinterpret_cast<uintptr_t>(&dst);
-    dst.mBody            = mWorld.CreateBody(&def);
-    b2CircleShape shape;
-    shape.m_p.Set(0.f, 0.f);
-    shape.m_radius                      = BallRadius;
-    dst.mFixture                        = dst.mBody->CreateFixture(&shape, 0.f);
+    b2FixtureDef fdef;
+    fdef.shape                          = &shape;
+    fdef.friction                       = 0.f;
+    fdef.restitution                    = 1.f;
+    dst.mFixture                        = grid.CreateFixture(&fdef);
     dst.mFixture->GetUserData().pointer = reinterpret_cast<uintptr_t>(&dst);
   }
+  mWorld.SetContactListener(this);
   addBall();
-  // Prep for rendering.
-  initGL();
+  packSquares();
+  if (mSink) {
+    // Everything goes up once, later flushes only upload the changes after that.
+    mDirtySquaresBegin = 0;
+    mDirtySquaresEnd   = NGrid;
+    mDirtyBallsBegin   = 0;
+    mDirtyBallsEnd     = NMaxBalls;
+    flush();
+  }
+}
+
+Arena::~Arena()
+{
+  mWorld.SetContactListener(nullptr);
 }
 
-void Arena::draw() const
+Physics Arena::physics() const
 {
-  bindGL();
-  GL_CALL(glDrawArrays(GL_POINTS, 0, mObjects.size()));
+  return mPhysics;
 }
 
-static void initAttributes()
+void Arena::stepGrid(float dt)
 {
-  static constexpr size_t stride     = sizeof(Object);
-  static const void*      posOffset  = (void*)(&(((Object*)nullptr)->mPos));
-  static const void*      dataOffset = (void*)(&(((Object*)nullptr)->mData));
-  static const void*      typeOffset = (void*)(&(((Object*)nullptr)->mType));
-  GL_CALL(glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, stride, posOffset));
-  GL_CALL(glEnableVertexAttribArray(0));
-  GL_CALL(glVertexAttribIPointer(1, 1, GL_INT, stride, dataOffset));
-  GL_CALL(glEnableVertexAttribArray(1));
-  GL_CALL(glVertexAttribIPointer(2, 1, GL_INT, stride, typeOffset));
-  GL_CALL(glEnableVertexAttribArray(2));
+  uint64_t solid = 0, sensors = 0;
+  auto     squares = getSquares();
+  for (uint32_t i = 0; i < NGrid; ++i) {
+    if (squares[i].mType == SQUARE) {
+      solid |= uint64_t(1) << i;
+    }
+    else if (squares[i].mType == BALL_SPWN) {
+      sensors |= uint64_t(1) << i;
+    }
+  }
+  mHits.clear();
+  mTouched.clear();
+  mGridPhysics->step(mNumBalls, dt, solid, sensors, mHits, mTouched);
+  for (uint32_t cell : mHits) {
+    hitSquare(squares[cell]);
+  }
+  for (uint32_t cell : mTouched) {
+    touchSquare(squares[cell]);
+  }
 }
 
-void Arena::initGL()
+void Arena::draw()
 {
-  // Create and bind the vertex array.
-  GL_CALL(glGenVertexArrays(1, &mVao));
-  GL_CALL(glGenBuffers(1, &mVbo));
-  bindGL();
-  // Copy data.
-  GL_CALL(glBufferData(
-    GL_ARRAY_BUFFER, sizeof(Object) * mObjects.size(), mObjects.data(), GL_DYNAMIC_DRAW));
-  // Initialize the attributes.
-  initAttributes();
-  unbindGL();
+  if (mSink) {
+    mSink->draw(mNumLiveSquares, mNumBalls);
+  }
 }
 
-void Arena::freeGL()
+void Arena::packSquares()
 {
-  if (mVao) {
-    GL_CALL(glDeleteVertexArrays(1, &mVao));
-    mVao = 0;
+  // The live squares are packed to the front, so that the draw only submits those.
+  auto     squares = getSquares();
+  uint32_t n       = 0;
+  for (uint32_t i = 0; i < NGrid; ++i) {
+    const auto& sq = squares[i];
+    if (sq.mType != NOSQUARE) {
+      Vertex v;
+      v.mPos = board::Centers[i];
+      v.setAttributes(sq);
+      setVertex(n++, v);
+    }
   }
-  if (mVbo) {
-    GL_CALL(glDeleteBuffers(1, &mVbo));
-    mVbo = 0;
+  mNumLiveSquares = n;
+}
+
+void Arena::setVertex(size_t i, const Vertex& v)
+{
+  auto& dst = mVertices[i];
+  if (dst.mPos != v.mPos || dst.mPacked != v.mPacked) {
+    dst = v;
+    markDirty(i);
   }
 }
 
-Arena::~Arena()
+void Arena::markDirty(size_t i)
+{
+  if (i < NGrid) {
+    mDirtySquaresBegin = std::min(mDirtySquaresBegin, uint32_t(i));
+    mDirtySquaresEnd   = std::max(mDirtySquaresEnd, uint32_t(i + 1));
+  }
+  else {
+    uint32_t bi      = uint32_t(i - NGrid);
+    mDirtyBallsBegin = std::min(mDirtyBallsBegin, bi);
+    mDirtyBallsEnd   = std::max(mDirtyBallsEnd, bi + 1);
+  }
+}
+
+void Arena::flush()
+{
+  if (!mSink) {
+    return;
+  }
+  trace::Scope trace("Arena::flush");
+  // Issuing a separate upload for every changed range costs more than copying a few
+  // unchanged vertices, so ranges closer than this are merged.
+  static constexpr size_t MergeGap = 64;
+  size_t                  first = mObjects.size(), last = 0;
+  if (mDirtySquaresBegin < mDirtySquaresEnd) {
+    first = mDirtySquaresBegin;
+    last  = mDirtySquaresEnd;
+  }
+  if (std::span<Vertex> stream = mSink->streamBalls(); !stream.empty()) {
+    // The balls are written straight to GPU visible memory every frame.
+    std::copy_n(mVertices.begin() + NGrid, mNumBalls, stream.begin());
+  }
+  else if (mDirtyBallsBegin < mDirtyBallsEnd) {
+    size_t b0 = NGrid + mDirtyBallsBegin;
+    size_t b1 = NGrid + mDirtyBallsEnd;
+    if (first < last && b0 - last > MergeGap) {
+      upload(first, last - first);
+      first = b0;
+    }
+    first = std::min(first, b0);
+    last  = b1;
+  }
+  if (first < last) {
+    upload(first, last - first);
+  }
+  mDirtySquaresBegin = NGrid;
+  mDirtySquaresEnd   = 0;
+  mDirtyBallsBegin   = NMaxBalls;
+  mDirtyBallsEnd     = 0;
+}
+
+void Arena::upload(size_t first, size_t count) const
 {
-  freeGL();
+  if (mSink) {
+    mSink->upload(first, std::span<const Vertex>(mVertices.data() + first, count));
+  }
 }
 
 int Arena::advance(uint32_t seed)
 {
+  trace::Scope trace("Arena::advance");
   auto squares = getSquares();
   if (std::any_of(squares.begin(), squares.begin() + NX, [](const Object& sq) {
         return sq.mType == SQUARE;
@@ -150,36 +243,19 @@ int Arena::advance(uint32_t seed)
       }
     }
   }
-  std::srand(seed);
-  for (auto& sq : getRow(NY - 1)) {
-    // TODO: Weighted sampling.
-    sq.mType = Type(std::rand() % 3);
+  auto row = getRow(NY - 1);
+  for (uint32_t i = 0; i < NX; ++i) {
+    auto& sq = row[i];
+    // Counter based, so each cell of each turn gets its own independent number.
+    sq.mType = sampleRowType(rng::philox({mCounter, i, 0, 0}, {seed, mSeed})[0]);
     // TODO: Properly assign mData.
-    if (sq.mType == SQUARE) {
-      sq.mData = mCounter;
-    }
+    sq.mData = sq.mType == SQUARE ? int(mCounter) : 0;
   }
   ++mCounter;
-  // Update GL buffers accordingly.
-  bindGL();
-  GL_CALL(glBufferSubData(
-    GL_ARRAY_BUFFER, 0, sizeof(Object) * mObjects.size(), mObjects.data()));
-  unbindGL();
+  packSquares();
   return 0;
 }
 
-void Arena::bindGL() const
-{
-  GL_CALL(glBindVertexArray(mVao));
-  GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, mVbo));
-}
-
-void Arena::unbindGL() const
-{
-  GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0));
-  GL_CALL(glBindVertexArray(0));
-}
-
 void Arena::initGridBody()
 {
   b2BodyDef def;
@@ -188,6 +264,22 @@ void Arena::initGridBody()
   mGrid = mWorld.CreateBody(&def);
 }
 
+void Arena::initWalls()
+{
+  // Left, top and right. The bottom is open, that's where the balls land.
+  const std::array<b2Vec2, 4> corners = {
+    b2Vec2(0.f, 0.f), b2Vec2(0.f, Height), b2Vec2(Width, Height), b2Vec2(Width, 0.f)};
+  for (size_t i = 0; i + 1 < corners.size(); ++i) {
+    b2EdgeShape shape;
+    shape.SetTwoSided(corners[i], corners[i + 1]);
+    b2FixtureDef fdef;
+    fdef.shape       = &shape;
+    fdef.friction    = 0.f;
+    fdef.restitution = 1.f;
+    mGrid->CreateFixture(&fdef);
+  }
+}
+
 std::span<Object> Arena::getSquares()
 {
   return std::span<Object>(mObjects.begin(), NGrid);
@@ -203,9 +295,515 @@ std::span<Object> Arena::getBalls()
   return std::span<Object>(mObjects.begin() + NGrid, NMaxBalls);
 }
 
+b2Body* Arena::acquireBallBody()
+{
+  if (!mBodyPool.empty()) {
+    b2Body* body = mBodyPool.back();
+    mBodyPool.pop_back();
+    body->SetEnabled(true);
+    return body;
+  }
+  b2BodyDef def;
+  def.type          = b2_dynamicBody;
+  def.bullet        = true;
+  def.fixedRotation = true;
+  // A sleeping ball wakes up differently depending on how long it slept, which would
+  // make the outcome of a turn depend on what happened before it.
+  def.allowSleep = false;
+  def.position.Set(mBallX, BallRadius);
+  b2Body*       body = mWorld.CreateBody(&def);
+  b2CircleShape shape;
+  shape.m_p.Set(0.f, 0.f);
+  shape.m_radius = BallRadius;
+  b2FixtureDef fdef;
+  fdef.shape       = &shape;
+  fdef.density     = 1.f;
+  fdef.friction    = 0.f;
+  fdef.restitution = 1.f;
+  // Balls pass through each other.
+  fdef.filter.groupIndex = -1;
+  body->CreateFixture(&fdef);
+  return body;
+}
+
 void Arena::addBall()
 {
-  auto& ball = getBalls()[mNumBalls++];
-  ball.mPos  = glm::vec2(mBallX, BallRadius);
-  ball.mType = BALL;
+  uint32_t  bi   = mNumBalls++;
+  auto&     ball = getBalls()[bi];
+  glm::vec2 pos  = {mBallX, BallRadius};
+  if (mPhysics == Physics::Box2D) {
+    // Bodies are only created when a ball goes live, so the cost of a physics step
+    // scales with the number of balls in play rather than the capacity.
+    ball.mBody                           = acquireBallBody();
+    ball.mFixture                        = ball.mBody->GetFixtureList();
+    ball.mBody->GetUserData().pointer    = reinterpret_cast<uintptr_t>(&ball);
+    ball.mFixture->GetUserData().pointer = reinterpret_cast<uintptr_t>(&ball);
+  }
+  placeBall(bi, {pos, {0.f, 0.f}});
+  ball.mType       = BALL;
+  setBallPos(bi, pos);
+  Vertex v;
+  v.mPos = pos;
+  v.setAttributes(ball);
+  setVertex(NGrid + bi, v);
+}
+
+void Arena::removeBall()
+{
+  auto& ball = getBalls()[--mNumBalls];
+  if (ball.mBody) {
+    ball.mBody->SetEnabled(false);
+    mBodyPool.push_back(ball.mBody);
+  }
+  ball = Object(NOBALL);
+}
+
+Arena::BallState Arena::ballState(uint32_t bi) const
+{
+  if (mGridPhysics) {
+    const auto& g = *mGridPhysics;
+    return {{g.mPosX[bi], g.mPosY[bi]}, {g.mVelX[bi], g.mVelY[bi]}};
+  }
+  const b2Body* body = mObjects[NGrid + bi].mBody;
+  const b2Vec2& p    = body->GetPosition();
+  const b2Vec2& v    = body->GetLinearVelocity();
+  return {{p.x, p.y}, {v.x, v.y}};
+}
+
+void Arena::setBallVelocity(uint32_t bi, glm::vec2 vel)
+{
+  if (mGridPhysics) {
+    mGridPhysics->mVelX[bi] = vel.x;
+    mGridPhysics->mVelY[bi] = vel.y;
+    return;
+  }
+  mObjects[NGrid + bi].mBody->SetLinearVelocity(b2Vec2(vel.x, vel.y));
+}
+
+void Arena::placeBall(uint32_t bi, const BallState& state)
+{
+  if (mGridPhysics) {
+    mGridPhysics->mPosX[bi] = state.mPos.x;
+    mGridPhysics->mPosY[bi] = state.mPos.y;
+  }
+  else {
+    mObjects[NGrid + bi].mBody->SetTransform(b2Vec2(state.mPos.x, state.mPos.y), 0.f);
+  }
+  setBallVelocity(bi, state.mVel);
+}
+
+void Arena::launch(float angle)
+{
+  if (mInPlay) {
+    return;
+  }
+  angle        = std::clamp(angle, MinAngle, std::numbers::pi_v<float> - MinAngle);
+  mLaunchDir   = {std::cos(angle), std::sin(angle)};
+  mNextBallX   = mBallX;
+  mNumLaunched = 0;
+  mNumLanded   = 0;
+  mLaunchTimer = 0;
+  mLanded.reset();
+  mInPlay = true;
+}
+
+bool Arena::inPlay() const
+{
+  return mInPlay;
+}
+
+glm::vec2 Arena::launchPoint() const
+{
+  return {mBallX, BallRadius};
+}
+
+void Arena::recall()
+{
+  if (!mInPlay) {
+    return;
+  }
+  mNumLaunched = mNumBalls;
+  for (uint32_t i = 0; i < mNumBalls; ++i) {
+    if (!mLanded[i]) {
+      land(i);
+    }
+  }
+  breakSquares();
+  endTurn();
+  syncBodies();
+}
+
+void Arena::onStep()
+{
+  if (mInPlay) {
+    launchNext();
+    updateBalls();
+    breakSquares();
+    if (mNumLanded == mNumBalls) {
+      endTurn();
+    }
+  }
+  syncBodies();
+}
+
+void Arena::launchNext()
+{
+  if (mNumLaunched == mNumBalls || mLaunchTimer-- > 0) {
+    return;
+  }
+  mLaunchTimer = LaunchInterval - 1;
+  setBallVelocity(mNumLaunched++, BallSpeed * mLaunchDir);
+}
+
+void Arena::updateBalls()
+{
+  for (uint32_t i = 0; i < mNumLaunched; ++i) {
+    if (mLanded[i]) {
+      continue;
+    }
+    auto [p, v] = ballState(i);
+    if (p.y <= BallRadius && v.y < 0.f) {
+      land(i);
+      continue;
+    }
+    // Collisions are elastic, but the solver still leaks a little speed. A ball that
+    // goes almost horizontal would also bounce between the side walls forever.
+    if (std::abs(v.y) < MinVerticalSpeed) {
+      v.y = v.y < 0.f ? -MinVerticalSpeed : MinVerticalSpeed;
+    }
+    setBallVelocity(i, BallSpeed * glm::normalize(v));
+  }
+}
+
+void Arena::land(uint32_t bi)
+{
+  if (mNumLanded++ == 0) {
+    // The first ball to land decides where the next turn launches from.
+    mNextBallX = std::clamp(ballState(bi).mPos.x, BallRadius, Width - BallRadius);
+  }
+  mLanded[bi] = true;
+  placeBall(bi, {{mNextBallX, BallRadius}, {0.f, 0.f}});
+}
+
+void Arena::breakSquares()
+{
+  // Squares are only removed after the step, so the hit that breaks a square still
+  // bounces the ball off of it.
+  if (!mBoardChanged) {
+    return;
+  }
+  for (auto& sq : getSquares()) {
+    if (sq.mType == SQUARE && sq.mData <= 0) {
+      sq.mType = NOSQUARE;
+      sq.mData = 0;
+    }
+  }
+  packSquares();
+  mBoardChanged = false;
+}
+
+void Arena::endTurn()
+{
+  mInPlay = false;
+  mBallX  = mNextBallX;
+  for (; mCollected > 0 && mNumBalls < NMaxBalls; --mCollected) {
+    addBall();
+  }
+  mCollected = 0;
+}
+
+Object* Arena::squareOf(b2Contact* contact) const
+{
+  for (b2Fixture* f : {contact->GetFixtureA(), contact->GetFixtureB()}) {
+    // The walls are on the grid body too, but don't have user data.
+    if (f->GetBody() == mGrid && f->GetUserData().pointer) {
+      return reinterpret_cast<Object*>(f->GetUserData().pointer);
+    }
+  }
+  return nullptr;
+}
+
+void Arena::hitSquare(Object& sq)
+{
+  if (sq.mType == SQUARE && sq.mData > 0) {
+    --sq.mData;
+    mBoardChanged = true;
+  }
+}
+
+bool Arena::touchSquare(Object& sq)
+{
+  if (sq.mType == BALL_SPWN) {
+    sq.mType = NOSQUARE;
+    ++mCollected;
+    mBoardChanged = true;
+  }
+  return sq.mType != NOSQUARE;
+}
+
+void Arena::BeginContact(b2Contact* contact)
+{
+  if (Object* sq = squareOf(contact)) {
+    hitSquare(*sq);
+  }
+}
+
+void Arena::PreSolve(b2Contact* contact, const b2Manifold*)
+{
+  Object* sq = squareOf(contact);
+  if (sq && !touchSquare(*sq)) {
+    contact->SetEnabled(false);
+  }
+}
+
+static_assert(std::is_trivially_copyable_v<Arena::Snapshot>);
+
+void Arena::snapshot(Snapshot& snap) const
+{
+  for (uint32_t i = 0; i < NGrid; ++i) {
+    snap.mSquares[i] = mObjects[i].mAttributes;
+  }
+  for (uint32_t i = 0; i < mNumBalls; ++i) {
+    snap.mBalls[i] = ballState(i);
+  }
+  snap.mLanded      = mLanded;
+  snap.mLaunchDir   = mLaunchDir;
+  snap.mBallX       = mBallX;
+  snap.mNextBallX   = mNextBallX;
+  snap.mSeed        = mSeed;
+  snap.mCounter     = mCounter;
+  snap.mNumBalls    = mNumBalls;
+  snap.mNumLaunched = mNumLaunched;
+  snap.mNumLanded   = mNumLanded;
+  snap.mLaunchTimer = mLaunchTimer;
+  snap.mCollected   = mCollected;
+  snap.mInPlay      = mInPlay;
+}
+
+void Arena::restore(const Snapshot& snap)
+{
+  auto squares = getSquares();
+  for (uint32_t i = 0; i < NGrid; ++i) {
+    squares[i].mAttributes = snap.mSquares[i];
+  }
+  while (mNumBalls < snap.mNumBalls) {
+    addBall();
+  }
+  while (mNumBalls > snap.mNumBalls) {
+    removeBall();
+  }
+  for (uint32_t i = 0; i < mNumBalls; ++i) {
+    const BallState& src = snap.mBalls[i];
+    placeBall(i, src);
+    setBallPos(i, src.mPos);
+    Vertex v = mVertices[NGrid + i];
+    v.mPos   = src.mPos;
+    setVertex(NGrid + i, v);
+  }
+  mLanded       = snap.mLanded;
+  mLaunchDir    = snap.mLaunchDir;
+  mBallX        = snap.mBallX;
+  mNextBallX    = snap.mNextBallX;
+  mSeed         = snap.mSeed;
+  mCounter      = snap.mCounter;
+  mNumLaunched  = snap.mNumLaunched;
+  mNumLanded    = snap.mNumLanded;
+  mLaunchTimer  = snap.mLaunchTimer;
+  mCollected    = snap.mCollected;
+  mInPlay       = snap.mInPlay;
+  mBoardChanged = false;
+  packSquares();
+}
+
+std::array<uint32_t, Arena::NGrid> Arena::board() const
+{
+  std::array<uint32_t, NGrid> cells;
+  for (uint32_t i = 0; i < NGrid; ++i) {
+    Vertex v;
+    v.setAttributes(mObjects[i]);
+    cells[i] = v.mPacked;
+  }
+  return cells;
+}
+
+uint64_t Arena::hash() const
+{
+  // FNV-1a.
+  uint64_t h   = 0xcbf29ce484222325;
+  auto     mix = [&h](uint32_t word) {
+    for (int i = 0; i < 4; ++i, word >>= 8) {
+      h = (h ^ (word & 0xff)) * 0x100000001b3;
+    }
+  };
+  for (uint32_t cell : board()) {
+    mix(cell);
+  }
+  mix(mCounter);
+  mix(mNumBalls);
+  mix(std::bit_cast<uint32_t>(mBallX));
+  return h;
+}
+
+float Arena::randomAngle(uint32_t turn) const
+{
+  // The last word of the counter keeps these apart from the numbers of the rows.
+  uint32_t r = rng::philox({turn, 0, 0, 1}, {0, mSeed})[0];
+  float    u = float(r >> 8) * 0x1p-24f;
+  return MinAngle + u * (std::numbers::pi_v<float> - 2.f * MinAngle);
+}
+
+void Arena::syncBodies()
+{
+  // Only the rendering looks at these.
+  if (!mSink) {
+    return;
+  }
+  mLatest ^= 1;
+  mPosChanged    = true;
+  PosBuffer& cur = mBallPos[mLatest];
+  if (mGridPhysics) {
+    std::copy_n(mGridPhysics->mPosX.begin(), mNumBalls, cur.mX.begin());
+    std::copy_n(mGridPhysics->mPosY.begin(), mNumBalls, cur.mY.begin());
+    return;
+  }
+  // The body pointers are chased once per step, here, and never per frame.
+  for (uint32_t i = 0; i < mNumBalls; ++i) {
+    const b2Vec2& p = mObjects[NGrid + i].mBody->GetPosition();
+    cur.mX[i]       = p.x;
+    cur.mY[i]       = p.y;
+  }
+}
+
+void Arena::setBallPos(uint32_t bi, glm::vec2 pos)
+{
+  for (auto& buf : mBallPos) {
+    buf.mX[bi] = pos.x;
+    buf.mY[bi] = pos.y;
+  }
+  mPosChanged = true;
+}
+
+void Arena::interpolate(float alpha)
+{
+  if (!mSink || !mNumBalls || (!mPosChanged && alpha == mLastAlpha)) {
+    return;
+  }
+  const PosBuffer& prev = mBallPos[mLatest ^ 1];
+  const PosBuffer& cur  = mBallPos[mLatest];
+  bool moved = simd::blendPositions(prev.mX.data(),
+                                    prev.mY.data(),
+                                    cur.mX.data(),
+                                    cur.mY.data(),
+                                    alpha,
+                                    mVertices.data() + NGrid,
+                                    mNumBalls);
+  if (moved || alpha != mLastAlpha) {
+    markDirty(NGrid);
+    markDirty(NGrid + mNumBalls - 1);
+  }
+  mLastAlpha  = alpha;
+  mPosChanged = false;
+}
+
+Stepper::Stepper(b2World& world, Arena& arena, const StepConfig& config)
+    : mWorld(world)
+    , mArena(arena)
+    , mConfig(config)
+{}
+
+float Stepper::timeStep() const
+{
+  return 1.f / mConfig.mHz;
+}
+
+float Stepper::update(double elapsed)
+{
+  const double dt = 1. / double(mConfig.mHz);
+  if (!mArena.inPlay()) {
+    mAccumulator = 0.;
+    return 1.f;
+  }
+  mAccumulator += std::max(elapsed, 0.);
+  for (uint32_t i = 0;
+       i < mConfig.mMaxSubSteps && mAccumulator >= dt && mArena.inPlay();
+       ++i) {
+    step();
+    mAccumulator -= dt;
+  }
+  if (!mArena.inPlay()) {
+    return 1.f;
+  }
+  if (mAccumulator >= dt) {
+    // We're falling behind. Drop the backlog instead of trying to catch up, or every
+    // frame will take longer than the one before it.
+    mAccumulator = std::fmod(mAccumulator, dt);
+  }
+  return float(mAccumulator / dt);
+}
+
+void Stepper::step()
+{
+  trace::Scope trace("Stepper::step");
+  if (mArena.physics() == Physics::Grid) {
+    mArena.stepGrid(timeStep());
+  }
+  else {
+    mWorld.Step(timeStep(), mConfig.mVelocityIterations, mConfig.mPositionIterations);
+  }
+  mArena.onStep();
+  if (!mArena.inPlay()) {
+    mTurnSteps = 0;
+  }
+  else if (++mTurnSteps >= MaxStepsPerTurn) {
+    mArena.recall();
+    mTurnSteps = 0;
+  }
+}
+
+void Stepper::reset()
+{
+  mTurnSteps = 0;
+}
+
+Simulation::Simulation(const StepConfig& config, uint32_t seed)
+    : mWorld(std::make_unique<b2World>(b2Vec2(0.f, 0.f)))
+    , mArena(*mWorld, nullptr, seed, config.mPhysics)
+    , mStepper(*mWorld, mArena, config)
+{}
+
+Simulation::~Simulation() {}
+
+bool Simulation::playTurn(uint32_t seed, float angle)
+{
+  if (mArena.advance(seed)) {
+    return false;
+  }
+  playShot(angle);
+  return true;
+}
+
+void Simulation::playShot(float angle)
+{
+  playShot(angle, std::chrono::steady_clock::time_point::max());
+}
+
+bool Simulation::playShot(float angle, std::chrono::steady_clock::time_point deadline)
+{
+  trace::Scope trace("Simulation::playShot");
+  mArena.launch(angle);
+  mStepper.reset();
+  // The stepper ends turns that run too long. Reading the clock costs a fraction of even
+  // the smallest step.
+  while (mArena.inPlay()) {
+    if (std::chrono::steady_clock::now() >= deadline) {
+      return false;
+    }
+    mStepper.step();
+  }
+  return true;
+}
+
+Arena& Simulation::arena()
+{
+  return mArena;
 }
@@ -1,15 +1,22 @@
 #pragma once
 
+#include <box2d/b2_world_callbacks.h>
 #include <stdint.h>
 #include <array>
+#include <bitset>
+#include <chrono>
 #include <cstddef>
 #include <glm/glm.hpp>
+#include <memory>
 #include <span>
 #include <string>
+#include <vector>
 
 class b2Body;
 class b2World;
 class b2Fixture;
+class b2Contact;
+class GridPhysics;
 
 enum Type : int
 {
@@ -24,7 +31,6 @@ struct Object
 {
   b2Fixture* mFixture = nullptr;
   b2Body*    mBody    = nullptr;
-  glm::vec2  mPos     = {0.f, 0.f};
   union
   {
     struct
@@ -39,7 +45,46 @@ struct Object
   explicit Object(Type type);
 };
 
-class Arena
+// The part of an object that is uploaded for rendering. The type is packed into the
+// lowest bits, and the data into the rest.
+struct Vertex
+{
+  static constexpr uint32_t TypeBits = 3;
+  static constexpr uint32_t TypeMask = (1u << TypeBits) - 1;
+
+  glm::vec2 mPos    = {0.f, 0.f};
+  uint32_t  mPacked = 0;
+
+  void setAttributes(const Object& obj)
+  {
+    mPacked = (uint32_t(obj.mData) << TypeBits) | (uint32_t(obj.mType) & TypeMask);
+  }
+  Type type() const { return Type(mPacked & TypeMask); }
+  int  data() const { return int(mPacked >> TypeBits); }
+};
+static_assert(sizeof(Vertex) == 12);
+
+// Receives the objects of an arena that need to be drawn.
+class RenderSink
+{
+public:
+  virtual ~RenderSink() = default;
+  // Copy the vertices into the render buffer, starting at index `first`.
+  virtual void upload(size_t first, std::span<const Vertex> vertices) = 0;
+  // GPU visible memory to write the ball vertices of the next frame into. Empty if the
+  // sink doesn't support streaming, in which case balls are uploaded like the rest.
+  virtual std::span<Vertex> streamBalls() { return {}; }
+  // Draw the first `nSquares` squares and the first `nBalls` balls.
+  virtual void draw(size_t nSquares, size_t nBalls) = 0;
+};
+
+enum class Physics
+{
+  Box2D,  // Balls are Box2D bullets.
+  Grid,   // Balls move in GridPhysics, which only knows about the arena layout.
+};
+
+class Arena : private b2ContactListener
 {
 public:
   static constexpr uint32_t NX         = 7;
@@ -51,30 +96,212 @@ public:
   static constexpr float    Height     = float(NY) * CellSize;
   static constexpr float    Width      = float(NX) * CellSize;
   static constexpr float    BallRadius = CellSize * 0.1f;
+  // Relative odds of NOSQUARE, SQUARE and BALL_SPWN in a new row. They add up to a power
+  // of two, so the top bits of a random number sample them without bias.
+  static constexpr std::array<uint32_t, 3> RowWeights = {7, 7, 2};
+  // Box2D moves a body at most b2_maxTranslation (2 units) per step, so at 120Hz balls
+  // can't go faster than 240 units per second.
+  static constexpr float    BallSpeed        = 2.f * CellSize;
+  static constexpr float    MinVerticalSpeed = 0.05f * BallSpeed;
+  static constexpr float    MinAngle         = 0.08f;  // Radians above the horizon.
+  static constexpr uint32_t LaunchInterval   = 12;     // Steps between launched balls.
 
-  explicit Arena(b2World& world);
-  void draw() const;
-  int  advance(uint32_t seed);
+  struct BallState
+  {
+    glm::vec2 mPos = {0.f, 0.f};
+    glm::vec2 mVel = {0.f, 0.f};
+  };
+
+  // Everything an arena needs to carry on from where it was. Plain data, so it can be
+  // memcpy'd, kept around in bulk, or written to disk as is. Only the first mNumBalls
+  // balls are meaningful. Those are the enabled bodies, the rest are disabled.
+  struct Snapshot
+  {
+    std::array<uint64_t, NGrid>      mSquares;
+    std::array<BallState, NMaxBalls> mBalls;
+    std::bitset<NMaxBalls>           mLanded;
+    glm::vec2                        mLaunchDir;
+    float                            mBallX;
+    float                            mNextBallX;
+    uint32_t                         mSeed;
+    uint32_t                         mCounter;
+    uint32_t                         mNumBalls;
+    uint32_t                         mNumLaunched;
+    uint32_t                         mNumLanded;
+    uint32_t                         mLaunchTimer;
+    uint32_t                         mCollected;
+    bool                             mInPlay;
+  };
+
+  // A null sink runs the arena headless, without any rendering. Arenas with different
+  // seeds generate different rows from the same sequence of turn seeds.
+  explicit Arena(b2World&    world,
+                 RenderSink* sink    = nullptr,
+                 uint32_t    seed    = 0,
+                 Physics     physics = Physics::Box2D);
   ~Arena();
+  Physics physics() const;
+  // Moves the balls by one step when they aren't simulated by Box2D.
+  void stepGrid(float dt);
+  // Draws the vertices as of the last flush.
+  void draw();
+  int  advance(uint32_t seed);
+  // Shoot all the balls in the given direction, in radians from the x axis. The turn
+  // lasts until every ball is back at the bottom.
+  void      launch(float angle);
+  bool      inPlay() const;
+  glm::vec2 launchPoint() const;
+  // Bring every ball back to the bottom right away, and end the turn.
+  void recall();
+  // Game logic that runs after each physics step.
+  void onStep();
+  // Blend the rendered ball positions between the last two physics steps.
+  void interpolate(float alpha);
+  // Upload the vertices that changed since the last upload. Once per frame, before the
+  // draw.
+  void flush();
+  // Restoring only touches the ball bodies, whose contacts are then rebuilt from their
+  // positions on the next step. Snapshots taken between turns play on exactly like the
+  // original with grid physics, in any arena. With Box2D that isn't promised, not even in
+  // the arena they came from, since the world keeps its own order of bodies and contacts.
+  // One taken mid-turn loses the contact history, so its last bits can differ.
+  void snapshot(Snapshot& snap) const;
+  void restore(const Snapshot& snap);
+  // Packed attributes of every cell, and a hash of those plus the ball state.
+  std::array<uint32_t, NGrid> board() const;
+  uint64_t                    hash() const;
+  // A launch angle for the given turn, drawn from the arena seed. For bots and
+  // benchmarks that need a reproducible sequence of shots.
+  float randomAngle(uint32_t turn) const;
 
 private:
   std::array<Object, NGrid + NMaxBalls> mObjects;
+  std::array<Vertex, NGrid + NMaxBalls> mVertices;
+  // Ball positions after the last two physics steps, one array per component so that
+  // the blend into the vertices runs on whole vectors. The latest positions are at
+  // mLatest, and the buffers trade places every step.
+  struct PosBuffer
+  {
+    alignas(32) std::array<float, NMaxBalls> mX;
+    alignas(32) std::array<float, NMaxBalls> mY;
+  };
+  std::array<PosBuffer, 2> mBallPos;
+  uint32_t                 mLatest     = 0;
+  float                    mLastAlpha  = 1.f;
+  bool                     mPosChanged = false;  // Since the last blend.
   b2Body*                               mGrid = nullptr;
+  std::vector<b2Body*>                  mBodyPool;  // Disabled ball bodies.
   b2World&                              mWorld;
-  uint32_t                              mCounter  = 1;
-  uint32_t                              mNumBalls = 0;
-  uint32_t                              mVao      = 0;
-  uint32_t                              mVbo      = 0;
-  float                                 mBallX    = 3.5f * CellSize;
+  RenderSink*                           mSink           = nullptr;
+  Physics                               mPhysics        = Physics::Box2D;
+  std::unique_ptr<GridPhysics>          mGridPhysics;
+  std::vector<uint32_t>                 mHits;     // Cells hit in the last grid step.
+  std::vector<uint32_t>                 mTouched;  // Sensor cells touched in it.
+  uint32_t                              mSeed           = 0;
+  uint32_t                              mCounter        = 1;
+  uint32_t                              mNumBalls       = 0;
+  uint32_t                              mNumLiveSquares = 0;
+  float                                 mBallX          = 3.5f * CellSize;
+  // State of the turn in play.
+  std::bitset<NMaxBalls> mLanded;
+  glm::vec2              mLaunchDir    = {0.f, 1.f};
+  float                  mNextBallX    = 0.f;
+  uint32_t               mNumLaunched  = 0;
+  uint32_t               mNumLanded    = 0;
+  uint32_t               mLaunchTimer  = 0;
+  uint32_t               mCollected    = 0;  // Balls picked up from spawns.
+  bool                   mInPlay       = false;
+  bool                   mBoardChanged = false;
+  // Vertices that changed since the last upload.
+  uint32_t mDirtySquaresBegin = NGrid;
+  uint32_t mDirtySquaresEnd   = 0;
+  uint32_t mDirtyBallsBegin   = NMaxBalls;
+  uint32_t mDirtyBallsEnd     = 0;
 
 private:
   void              initGridBody();
-  void              initGL();
-  void              freeGL();
-  void              bindGL() const;
-  void              unbindGL() const;
+  void              initWalls();
+  void              packSquares();
+  void              setVertex(size_t i, const Vertex& v);
+  void              markDirty(size_t i);
+  void              upload(size_t first, size_t count) const;
   std::span<Object> getSquares();
   std::span<Object> getRow(uint32_t i);
   std::span<Object> getBalls();
+  b2Body*           acquireBallBody();
   void              addBall();
+  void              removeBall();
+  BallState         ballState(uint32_t bi) const;
+  void              setBallVelocity(uint32_t bi, glm::vec2 vel);
+  void              placeBall(uint32_t bi, const BallState& state);
+  void              hitSquare(Object& sq);
+  bool              touchSquare(Object& sq);
+  void              launchNext();
+  void              updateBalls();
+  void              land(uint32_t bi);
+  void              breakSquares();
+  void              endTurn();
+  void              syncBodies();
+  void              setBallPos(uint32_t bi, glm::vec2 pos);
+  Object*           squareOf(b2Contact* contact) const;
+  void              BeginContact(b2Contact* contact) override;
+  void              PreSolve(b2Contact* contact, const b2Manifold* oldManifold) override;
+};
+
+struct StepConfig
+{
+  float    mHz                 = 120.f;
+  uint32_t mMaxSubSteps        = 8;
+  int32_t  mVelocityIterations = 8;
+  int32_t  mPositionIterations = 3;
+  Physics  mPhysics            = Physics::Box2D;
+};
+
+// Steps the physics world at a fixed rate, independent of the frame rate.
+class Stepper
+{
+public:
+  // Ten minutes of simulated time at 120Hz. A turn that takes longer has a ball stuck
+  // somewhere, so the balls are recalled.
+  static constexpr uint32_t MaxStepsPerTurn = 72000;
+
+  Stepper(b2World& world, Arena& arena, const StepConfig& config = {});
+  // Runs the steps that are due after `elapsed` seconds, up to mMaxSubSteps. Returns the
+  // fraction of a step left in the accumulator, for interpolation. The world only moves
+  // while a turn is in play, so a turn takes the same steps however the frames fall.
+  float update(double elapsed);
+  // Runs exactly one step. Ends the turn after MaxStepsPerTurn steps.
+  void  step();
+  // Counts the steps of the turn in play from zero, after the arena was restored.
+  void  reset();
+  float timeStep() const;
+
+private:
+  b2World&   mWorld;
+  Arena&     mArena;
+  StepConfig mConfig;
+  double     mAccumulator = 0.;
+  uint32_t   mTurnSteps   = 0;  // Since the turn in play was launched.
+};
+
+// A world and an arena that play turns without rendering.
+class Simulation
+{
+public:
+  explicit Simulation(const StepConfig& config = {}, uint32_t seed = 0);
+  ~Simulation();
+  // Adds a row generated from `seed`, then launches at `angle` and steps until the balls
+  // are back. Returns false if the game is over.
+  bool   playTurn(uint32_t seed, float angle);
+  // Launches at `angle` from the current position and steps until the balls are back.
+  void   playShot(float angle);
+  // The same, but gives up at `deadline` and leaves the turn in play. Returns false if it
+  // gave up.
+  bool   playShot(float angle, std::chrono::steady_clock::time_point deadline);
+  Arena& arena();
+
+private:
+  std::unique_ptr<b2World> mWorld;
+  Arena                    mArena;
+  Stepper                  mStepper;
 };
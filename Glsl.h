@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+#include <array>
+#include <stdexcept>
+#include <string_view>
+
+// Shader sources, with their constants written out, built at compile time.
+namespace glsl {
+
+// A string of up to N characters that can be built in a constant expression. Running out
+// of room stops the compilation.
+template<size_t N = 4096>
+class FixedString
+{
+public:
+  constexpr FixedString& operator<<(std::string_view str)
+  {
+    if (mSize + str.size() > N) {
+      throw std::length_error("The string is too long.");
+    }
+    for (char c : str) {
+      mData[mSize++] = c;
+    }
+    return *this;
+  }
+
+  constexpr FixedString& operator<<(uint32_t value)
+  {
+    std::array<char, 10> digits;
+    size_t               n = 0;
+    do {
+      digits[n++] = char('0' + value % 10);
+      value /= 10;
+    } while (value);
+    while (n) {
+      *this << std::string_view(&digits[--n], 1);
+    }
+    return *this;
+  }
+
+  constexpr FixedString& operator<<(int value)
+  {
+    if (value < 0) {
+      *this << "-";
+    }
+    return *this << uint32_t(value < 0 ? -int64_t(value) : value);
+  }
+
+  // Fixed point with 8 decimals, which is all a float has for the small values here.
+  constexpr FixedString& operator<<(float value)
+  {
+    if (value < 0.f) {
+      *this << "-";
+      value = -value;
+    }
+    uint64_t fixed = uint64_t(double(value) * double(Scale) + 0.5);
+    *this << uint32_t(fixed / Scale) << ".";
+    for (uint64_t d = Scale / 10; d; d /= 10) {
+      *this << std::string_view(&"0123456789"[(fixed / d) % 10], 1);
+    }
+    return *this;
+  }
+
+  constexpr std::string_view view() const { return {mData.data(), mSize}; }
+
+private:
+  static constexpr uint64_t Scale = 100000000;
+
+  std::array<char, N + 1> mData = {};
+  size_t                  mSize = 0;
+};
+
+}  // namespace glsl
@@ -0,0 +1,221 @@
+#include <Board.h>
+#include <GridPhysics.h>
+#include <Simd.h>
+#include <algorithm>
+#include <cmath>
+
+static constexpr float R       = Arena::BallRadius;
+static constexpr float InvCell = 1.f / Arena::CellSize;
+
+static int cellCoord(float v, uint32_t n)
+{
+  return std::clamp(int(v * InvCell), 0, int(n) - 1);
+}
+
+// Earliest fraction `t` of the move `d` at which a circle of radius `r` at `p` touches
+// the box [lo, hi], and the normal of the box there. Only contacts the circle moves
+// into count, so a ball that just bounced off a box doesn't hit it again. A circle whose
+// center is already inside the box touches it right away, and has to be moved `depth`
+// along the normal to get out.
+static bool sweepBox(glm::vec2  p,
+                     glm::vec2  d,
+                     glm::vec2  lo,
+                     glm::vec2  hi,
+                     float      r,
+                     float&     t,
+                     glm::vec2& n,
+                     float&     depth)
+{
+  glm::vec2 off   = p - glm::clamp(p, lo, hi);
+  float     dist2 = glm::dot(off, off);
+  depth           = 0.f;
+  if (dist2 <= r * r) {
+    // Already touching.
+    if (dist2 == 0.f) {
+      // Out through the nearest face.
+      glm::vec2 below = p - lo;
+      glm::vec2 above = hi - p;
+      glm::vec2 in    = glm::min(below, above);
+      int       axis  = in.x < in.y ? 0 : 1;
+      n               = {0.f, 0.f};
+      n[axis]         = below[axis] < above[axis] ? -1.f : 1.f;
+      depth           = in[axis] + r;
+      t               = 0.f;
+      return true;
+    }
+    n = off / std::sqrt(dist2);
+    t = 0.f;
+    return glm::dot(d, n) < 0.f;
+  }
+  // Slabs of the box grown by r. This is exact on the faces, the corners are rounded
+  // off below.
+  float tmin = 0.f, tmax = 1.f;
+  int   axis = -1;
+  for (int a = 0; a < 2; ++a) {
+    if (d[a] == 0.f) {
+      if (p[a] < lo[a] - r || p[a] > hi[a] + r) {
+        return false;
+      }
+      continue;
+    }
+    float t1 = (lo[a] - r - p[a]) / d[a];
+    float t2 = (hi[a] + r - p[a]) / d[a];
+    if (t1 > t2) {
+      std::swap(t1, t2);
+    }
+    if (t1 > tmin) {
+      tmin = t1;
+      axis = a;
+    }
+    tmax = std::min(tmax, t2);
+    if (tmin > tmax) {
+      return false;
+    }
+  }
+  glm::vec2 q       = p + tmin * d;
+  bool      cornerX = q.x < lo.x || q.x > hi.x;
+  bool      cornerY = q.y < lo.y || q.y > hi.y;
+  if (cornerX && cornerY) {
+    glm::vec2 c  = {q.x < lo.x ? lo.x : hi.x, q.y < lo.y ? lo.y : hi.y};
+    glm::vec2 pc = p - c;
+    float     a  = glm::dot(d, d);
+    float     b  = glm::dot(pc, d);
+    float     k  = glm::dot(pc, pc) - r * r;
+    float     disc = b * b - a * k;
+    if (disc < 0.f) {
+      return false;
+    }
+    t = (-b - std::sqrt(disc)) / a;
+    if (t < 0.f || t > 1.f) {
+      return false;
+    }
+    n = glm::normalize(p + t * d - c);
+    return true;
+  }
+  if (axis < 0) {
+    return false;
+  }
+  t       = tmin;
+  n       = {0.f, 0.f};
+  n[axis] = d[axis] < 0.f ? 1.f : -1.f;
+  return true;
+}
+
+void GridPhysics::step(uint32_t               n,
+                       float                  dt,
+                       uint64_t               solid,
+                       uint64_t               sensors,
+                       std::vector<uint32_t>& hits,
+                       std::vector<uint32_t>& touched)
+{
+  // Balls whose swept bounds stay clear of the walls and of every occupied cell just
+  // move, in vector kernels picked for this machine. The rest are left for the sweep.
+  // Bounds spanning more than two cells either way only happen with very long steps,
+  // and go to the sweep too.
+  simd::moveClearBalls(mPosX.data(),
+                       mPosY.data(),
+                       mVelX.data(),
+                       mVelY.data(),
+                       dt,
+                       solid | sensors,
+                       mNear.data(),
+                       n);
+  for (uint32_t i = 0; i < n; ++i) {
+    if (mNear[i]) {
+      sweep(i, dt, solid, sensors, hits, touched);
+    }
+  }
+}
+
+void GridPhysics::sweep(uint32_t               i,
+                        float                  dt,
+                        uint64_t               solid,
+                        uint64_t               sensors,
+                        std::vector<uint32_t>& hits,
+                        std::vector<uint32_t>& touched)
+{
+  // A ball wedged between two squares can bounce more than once in a step. Whatever is
+  // left of the step after this many bounces is dropped.
+  static constexpr int MaxBounces = 4;
+  glm::vec2            p          = {mPosX[i], mPosY[i]};
+  glm::vec2            v          = {mVelX[i], mVelY[i]};
+  float                remaining  = dt;
+  for (int bounce = 0; bounce < MaxBounces && remaining > 0.f; ++bounce) {
+    glm::vec2 d      = v * remaining;
+    float     t      = 1.f;
+    glm::vec2 normal = {0.f, 0.f};
+    float     depth  = 0.f;  // To push the ball out of a square it is inside.
+    int       cell   = -1;
+    bool      hit    = false;
+    // Distance to the wall, and the speed towards it. The bottom is open.
+    auto wall = [&](float dist, float speed, glm::vec2 wn) {
+      if (speed > 0.f) {
+        float tw = std::max(dist, 0.f) / speed;
+        if (tw < t) {
+          t      = tw;
+          normal = wn;
+          depth  = 0.f;
+          cell   = -1;
+          hit    = true;
+        }
+      }
+    };
+    wall(p.x - R, -d.x, {1.f, 0.f});
+    wall(Arena::Width - R - p.x, d.x, {-1.f, 0.f});
+    wall(Arena::Height - R - p.y, d.y, {0.f, -1.f});
+    glm::vec2 lo = glm::min(p, p + d) - R;
+    glm::vec2 hi = glm::max(p, p + d) + R;
+    for (int cy = cellCoord(lo.y, Arena::NY); cy <= cellCoord(hi.y, Arena::NY); ++cy) {
+      for (int cx = cellCoord(lo.x, Arena::NX); cx <= cellCoord(hi.x, Arena::NX); ++cx) {
+        int c = cy * int(Arena::NX) + cx;
+        if (!((solid >> c) & 1)) {
+          continue;
+        }
+        const auto& corners = board::Corners[c];
+        float       tc;
+        glm::vec2   nc;
+        float       dc;
+        // Getting out of a square the ball is inside comes before anything else.
+        if (sweepBox(p, d, corners[0], corners[2], R, tc, nc, dc)
+            && (tc < t || dc > 0.f)) {
+          t      = tc;
+          normal = nc;
+          depth  = dc;
+          cell   = c;
+          hit    = true;
+        }
+      }
+    }
+    if (!hit) {
+      p += d;
+      break;
+    }
+    p += t * d + depth * normal;
+    float vn = glm::dot(v, normal);
+    if (vn < 0.f) {
+      v -= 2.f * vn * normal;
+    }
+    if (cell >= 0) {
+      hits.push_back(uint32_t(cell));
+    }
+    remaining *= 1.f - t;
+  }
+  int cx0 = cellCoord(p.x - R, Arena::NX), cx1 = cellCoord(p.x + R, Arena::NX);
+  int cy0 = cellCoord(p.y - R, Arena::NY), cy1 = cellCoord(p.y + R, Arena::NY);
+  for (int cy = cy0; cy <= cy1; ++cy) {
+    for (int cx = cx0; cx <= cx1; ++cx) {
+      int c = cy * int(Arena::NX) + cx;
+      if ((sensors >> c) & 1) {
+        const auto& corners = board::Corners[c];
+        glm::vec2   off     = p - glm::clamp(p, corners[0], corners[2]);
+        if (glm::dot(off, off) <= R * R) {
+          touched.push_back(uint32_t(c));
+        }
+      }
+    }
+  }
+  mPosX[i] = p.x;
+  mPosY[i] = p.y;
+  mVelX[i] = v.x;
+  mVelY[i] = v.y;
+}
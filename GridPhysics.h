@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+#include <array>
+#include <vector>
+
+#include <Game.h>
+
+// Moves balls through the arena without Box2D. The balls are circles that never touch
+// each other, the squares are axis aligned boxes in the fixed grid of the arena, and
+// every collision is elastic. That's all a turn needs, so instead of general purpose
+// continuous collision, each ball is swept analytically against the few cells it can
+// reach in a step.
+//
+// The turns don't play out exactly like with Box2D, whose bullets get position
+// correction and sub-stepped contacts. cabbage_check plays the same shots with both and
+// expects nine turns in ten to break the same squares give or take one, with the first
+// ball landing within a quarter of a cell. The divergence it prints hasn't been recorded
+// here yet, as no Box2D build has run that check.
+class GridPhysics
+{
+public:
+  static constexpr uint32_t N = Arena::NMaxBalls;
+  static_assert(Arena::NGrid <= 64, "Cells are tracked in 64 bit masks");
+
+  // Ball state, one array per component, so that the common case of a ball in open
+  // space goes through simd::moveClearBalls a vector of balls at a time.
+  alignas(32) std::array<float, N> mPosX = {};
+  alignas(32) std::array<float, N> mPosY = {};
+  alignas(32) std::array<float, N> mVelX = {};
+  alignas(32) std::array<float, N> mVelY = {};
+
+  // Moves the first `n` balls by `dt`. Balls bounce off the walls and off the cells in
+  // `solid`, and every such bounce appends the cell to `hits`. Cells in `sensors` don't
+  // stop the balls, and are appended to `touched` when a ball overlaps them.
+  void step(uint32_t               n,
+            float                  dt,
+            uint64_t               solid,
+            uint64_t               sensors,
+            std::vector<uint32_t>& hits,
+            std::vector<uint32_t>& touched);
+
+private:
+  alignas(32) std::array<uint8_t, N> mNear = {};
+
+  void sweep(uint32_t               i,
+             float                  dt,
+             uint64_t               solid,
+             uint64_t               sensors,
+             std::vector<uint32_t>& hits,
+             std::vector<uint32_t>& touched);
+};
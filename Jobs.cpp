@@ -0,0 +1,211 @@
+#include <GLUtil.h>
+#include <Jobs.h>
+#include <Trace.h>
+#include <algorithm>
+#include <chrono>
+
+static thread_local uint32_t sWorker = 0;
+
+JobSystem::JobSystem(uint32_t nWorkers)
+{
+  nWorkers = std::max(nWorkers, 1u);
+  mQueues.reserve(nWorkers);
+  for (uint32_t i = 0; i < nWorkers; ++i) {
+    mQueues.push_back(std::make_unique<Queue>());
+  }
+  mThreads.reserve(nWorkers);
+  for (uint32_t i = 0; i < nWorkers; ++i) {
+    mThreads.emplace_back(&JobSystem::run, this, i);
+  }
+}
+
+JobSystem::~JobSystem()
+{
+  wait();
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mStop = true;
+  }
+  mWake.notify_all();
+  for (auto& thread : mThreads) {
+    thread.join();
+  }
+}
+
+uint32_t JobSystem::numWorkers() const
+{
+  return uint32_t(mThreads.size());
+}
+
+uint32_t JobSystem::currentWorker()
+{
+  return sWorker;
+}
+
+void JobSystem::submit(uint32_t worker, Job job)
+{
+  auto& queue = *mQueues[worker % mQueues.size()];
+  ++mPending;
+  {
+    // Taking the lock makes sure a worker that is about to sleep sees the new job.
+    std::lock_guard<std::mutex> lock(mMutex);
+    ++mQueued;
+  }
+  {
+    std::lock_guard<std::mutex> lock(queue.mMutex);
+    queue.mJobs.push_back(std::move(job));
+  }
+  mWake.notify_all();
+}
+
+void JobSystem::submitPinned(uint32_t worker, Job job)
+{
+  auto& queue = *mQueues[worker % mQueues.size()];
+  ++mPending;
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    ++queue.mNumPinned;
+  }
+  {
+    std::lock_guard<std::mutex> lock(queue.mMutex);
+    queue.mPinned.push_back(std::move(job));
+  }
+  mWake.notify_all();
+}
+
+void JobSystem::wait()
+{
+  std::unique_lock<std::mutex> lock(mMutex);
+  mDone.wait(lock, [this] { return mPending == 0; });
+}
+
+bool JobSystem::pop(uint32_t worker, Job& job)
+{
+  const size_t n = mQueues.size();
+  // Pinned jobs first, in order.
+  {
+    auto&                       queue = *mQueues[worker];
+    std::lock_guard<std::mutex> lock(queue.mMutex);
+    if (!queue.mPinned.empty()) {
+      job = std::move(queue.mPinned.front());
+      queue.mPinned.pop_front();
+      --queue.mNumPinned;
+      return true;
+    }
+  }
+  // Then own queue, from the back, then steal from the front of the others.
+  for (size_t i = 0; i < n; ++i) {
+    auto&                       queue = *mQueues[(worker + i) % n];
+    std::lock_guard<std::mutex> lock(queue.mMutex);
+    if (queue.mJobs.empty()) {
+      continue;
+    }
+    if (i == 0) {
+      job = std::move(queue.mJobs.back());
+      queue.mJobs.pop_back();
+    }
+    else {
+      job = std::move(queue.mJobs.front());
+      queue.mJobs.pop_front();
+    }
+    --mQueued;
+    return true;
+  }
+  return false;
+}
+
+void JobSystem::run(uint32_t worker)
+{
+  sWorker = worker;
+  trace::nameThread(fmt::format("worker {}", worker));
+  Job job;
+  while (true) {
+    if (pop(worker, job)) {
+      job();
+      job = nullptr;
+      if (--mPending == 0) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mDone.notify_all();
+      }
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(mMutex);
+    mWake.wait(lock, [this, worker] {
+      return mStop || mQueued > 0 || mQueues[worker]->mNumPinned > 0;
+    });
+    if (mStop) {
+      return;
+    }
+  }
+}
+
+WorldPool::WorldPool(JobSystem& jobs, uint32_t nWorlds, const StepConfig& config)
+    : mJobs(jobs)
+    , mConfig(config)
+    , mWorlds(nWorlds)
+    , mStats(nWorlds)
+{
+  for (uint32_t i = 0; i < nWorlds; ++i) {
+    auto& world = mWorlds[i];
+    world.mHome = i % mJobs.numWorkers();
+    mJobs.submitPinned(world.mHome, [this, &world, i] {
+      world.mSim = std::make_unique<Simulation>(mConfig, i);
+    });
+  }
+  mJobs.wait();
+}
+
+void WorldPool::playTurn()
+{
+  for (uint32_t i = 0; i < mWorlds.size(); ++i) {
+    mJobs.submitPinned(mWorlds[i].mHome, [this, i] {
+      auto& world = mWorlds[i];
+      auto& stats = mStats[i];
+      auto  start = std::chrono::steady_clock::now();
+      // Every world has its own arena seed, so they can all share the turn seeds.
+      float angle = world.mSim->arena().randomAngle(world.mTurn);
+      if (!world.mSim->playTurn(world.mTurn++, angle)) {
+        uint32_t seed = i + uint32_t(mWorlds.size() * stats.mGames++);
+        world.mSim    = std::make_unique<Simulation>(mConfig, seed);
+      }
+      double seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      ++stats.mTurns;
+      stats.mTotalSeconds += seconds;
+      stats.mMaxSeconds = std::max(stats.mMaxSeconds, seconds);
+    });
+  }
+  mJobs.wait();
+}
+
+const std::vector<WorldStats>& WorldPool::stats() const
+{
+  return mStats;
+}
+
+void WorldPool::logStats() const
+{
+  if (mStats.empty()) {
+    return;
+  }
+  std::vector<double> means(mStats.size());
+  std::transform(mStats.begin(), mStats.end(), means.begin(), [](const WorldStats& s) {
+    return s.mTurns ? s.mTotalSeconds / double(s.mTurns) : 0.;
+  });
+  std::sort(means.begin(), means.end());
+  double worst = std::max_element(mStats.begin(),
+                                   mStats.end(),
+                                   [](const WorldStats& a, const WorldStats& b) {
+                                     return a.mMaxSeconds < b.mMaxSeconds;
+                                   })
+                   ->mMaxSeconds;
+  view::logger().info(
+    "{} worlds on {} workers. Mean turn latency per world: min {:.3f}ms, median "
+    "{:.3f}ms, max {:.3f}ms. Slowest turn {:.3f}ms.",
+    mStats.size(),
+    mJobs.numWorkers(),
+    1000. * means.front(),
+    1000. * means[means.size() / 2],
+    1000. * means.back(),
+    1000. * worst);
+}
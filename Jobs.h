@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <Game.h>
+
+// A pool of worker threads, each with its own queue of jobs. Workers run the jobs from
+// their own queue first, and steal from the other queues when they run out. Pinned jobs
+// are never stolen.
+class JobSystem
+{
+public:
+  using Job = std::function<void()>;
+
+  explicit JobSystem(uint32_t nWorkers = std::thread::hardware_concurrency());
+  ~JobSystem();
+  uint32_t numWorkers() const;
+  // Index of the worker running the calling thread. Only meaningful inside a job.
+  static uint32_t currentWorker();
+  // Queue the job on the given worker.
+  void submit(uint32_t worker, Job job);
+  // Queue the job on the given worker, which is the only one that runs it.
+  void submitPinned(uint32_t worker, Job job);
+  // Block until all submitted jobs have finished.
+  void wait();
+  JobSystem(const JobSystem&) = delete;
+  JobSystem(JobSystem&&)      = delete;
+
+private:
+  struct Queue
+  {
+    std::mutex          mMutex;
+    std::deque<Job>     mJobs;
+    std::deque<Job>     mPinned;
+    std::atomic<size_t> mNumPinned = 0;
+  };
+
+  void run(uint32_t worker);
+  bool pop(uint32_t worker, Job& job);
+
+  std::vector<std::unique_ptr<Queue>> mQueues;
+  std::vector<std::thread>            mThreads;
+  std::mutex                          mMutex;
+  std::condition_variable             mWake;
+  std::condition_variable             mDone;
+  std::atomic<size_t>                 mQueued  = 0;
+  std::atomic<size_t>                 mPending = 0;
+  bool                                mStop    = false;
+};
+
+struct WorldStats
+{
+  uint64_t mTurns        = 0;
+  uint64_t mGames        = 1;
+  double   mTotalSeconds = 0.;
+  double   mMaxSeconds   = 0.;
+};
+
+// Many independent simulations stepped in parallel. Each one is created and played only
+// by its own home worker, so that its memory stays local to that worker.
+class WorldPool
+{
+public:
+  WorldPool(JobSystem& jobs, uint32_t nWorlds, const StepConfig& config = {});
+  // Play one turn in every world. Worlds whose game is over start a new game.
+  void                           playTurn();
+  const std::vector<WorldStats>& stats() const;
+  void                           logStats() const;
+
+private:
+  struct World
+  {
+    std::unique_ptr<Simulation> mSim;
+    uint32_t                    mHome = 0;
+    uint32_t                    mTurn = 0;
+  };
+
+  JobSystem&              mJobs;
+  StepConfig              mConfig;
+  std::vector<World>      mWorlds;
+  std::vector<WorldStats> mStats;
+};
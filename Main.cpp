@@ -1,84 +1,138 @@
+#include <charconv>
+#include <chrono>
 #include <iostream>
+#include <optional>
+#include <random>
+#include <string_view>
 
 #include <GLUtil.h>
 #include <Game.h>
+#include <Jobs.h>
+#include <Profiler.h>
+#include <Replay.h>
+#include <Solver.h>
+#include <Trace.h>
 #include <box2d/box2d.h>
 
-static void glfw_error_cb(int error, const char* desc)
-{
-  view::logger().error("GLFW Error {}: {}", error, desc);
-}
-
-static void onMouseButton(GLFWwindow* window, int button, int action, int mods) {}
-
-void onMouseMove(GLFWwindow* window, double xpos, double ypos) {}
+// Where the player last clicked, in window coordinates, until the game loop takes it.
+static std::optional<glm::vec2> sClick;
+// Set by a right click, to let the aim solver take the next shot.
+static bool sAssist = false;
 
-int initGL(GLFWwindow*& window)
+static void onMouseButton(GLFWwindow* window, int button, int action, int mods)
 {
-  glfwSetErrorCallback(glfw_error_cb);
-  if (!glfwInit()) {
-    view::logger().error("Failed to initialize GLFW.");
-    return 1;
+  if (button == GLFW_MOUSE_BUTTON_RIGHT && action == GLFW_PRESS) {
+    sAssist = true;
+    return;
   }
-  view::logger().info("Initialized GLFW.");
-  // Window setup
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-  glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
-  std::string title = "Cabbage";
-  window = glfwCreateWindow(Arena::Width, Arena::Height, title.c_str(), nullptr, nullptr);
-  if (window == nullptr) {
-    return 1;
+  if (button != GLFW_MOUSE_BUTTON_LEFT || action != GLFW_PRESS) {
+    return;
   }
-  glfwMakeContextCurrent(window);
-  // OpenGL bindings
-  int err = GLEW_OK;
-  if ((err = glewInit()) != GLEW_OK) {
-    view::logger().error("Failed to initialize OpenGL bindings: {}", err);
-    return 1;
-  }
-  view::logger().info("OpenGL bindings are ready.");
-  int W, H;
-  GL_CALL(glfwGetFramebufferSize(window, &W, &H));
-  GL_CALL(glViewport(0, 0, W, H));
-  GL_CALL(glEnable(GL_DEPTH_TEST));
-  GL_CALL(glEnable(GL_BLEND));
-  GL_CALL(glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA));
-  GL_CALL(glEnable(GL_LINE_SMOOTH));
-  GL_CALL(glEnable(GL_PROGRAM_POINT_SIZE));
-  GL_CALL(glPointSize(3.0f));
-  GL_CALL(glLineWidth(1.0f));
-  GL_CALL(glPolygonMode(GL_FRONT_AND_BACK, GL_FILL));
-  glfwSetMouseButtonCallback(window, &onMouseButton);
-  glfwSetCursorPosCallback(window, onMouseMove);
-  return 0;
+  double x, y;
+  glfwGetCursorPos(window, &x, &y);
+  sClick = glm::vec2 {float(x), float(y)};
 }
 
-static int game()
+void onMouseMove(GLFWwindow* window, double xpos, double ypos) {}
+
+
+static int game(view::Pipeline     pipeline,
+                view::Font         font,
+                Physics            physics,
+                float              renderScale,
+                const std::string& recordPath,
+                bool               showStats)
 {
   GLFWwindow* window = nullptr;
   try {
     int err = 0;
-    if ((err = initGL(window))) {
+    if ((err = view::initGL(window))) {
       view::logger().error("Failed to initialize the viewier. Error code {}.", err);
       return err;
     }
+    glfwSetMouseButtonCallback(window, &onMouseButton);
+    glfwSetCursorPosCallback(window, onMouseMove);
     {
-      b2World world(b2Vec2(0.f, 0.f));
-      Arena   arena(world);
-      arena.advance(42);
-      arena.advance(23);
-      view::Shader shader;
-      shader.use();
-      // TODO: Initialize and use shader
+      uint32_t     arenaSeed = std::random_device {}();
+      b2World      world(b2Vec2(0.f, 0.f));
+      view::Screen screen(window, renderScale);
+      view::GLSink sink(pipeline, font);
+      StepConfig   config;
+      config.mPhysics = physics;
+      Arena   arena(world, &sink, arenaSeed, physics);
+      Stepper stepper(world, arena, config);
+      std::optional<ReplayWriter> recorder;
+      if (!recordPath.empty()) {
+        recorder.emplace(recordPath, arenaSeed, config);
+        if (!recorder->good()) {
+          view::logger().error("Cannot record to '{}'.", recordPath);
+          return 1;
+        }
+      }
+      // The solver and its workers are only started when the player first asks for help.
+      std::optional<JobSystem> jobs;
+      std::optional<AimSolver> solver;
+      view::Profiler           profiler(showStats);
+      uint32_t                 turn  = 0;
+      float                    angle = 0.f;
+      arena.advance(turn);
+      double time = glfwGetTime();
       while (!glfwWindowShouldClose(window)) {
+        trace::Scope frame("frame");
         glfwPollEvents();
-        glClearColor(0.1f, 0.1f, 0.1f, 1.f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        // Draw stuff.
-        arena.draw();
+        if (sClick && !arena.inPlay()) {
+          glm::vec2 dir = screen.toArena(*sClick) - arena.launchPoint();
+          angle         = std::atan2(dir.y, dir.x);
+          arena.launch(angle);
+        }
+        else if (sAssist && !arena.inPlay()) {
+          static constexpr uint32_t AssistShots = 256;
+          static constexpr auto     AssistBudget = std::chrono::milliseconds(200);
+          if (!solver) {
+            jobs.emplace();
+            solver.emplace(*jobs, config);
+          }
+          Aim aim = solver->solve(arena, AssistShots, AssistBudget, turn);
+          view::logger().info("Assist: {} shots in {:.1f}ms, best breaks {} squares.",
+                              aim.mNumShots,
+                              aim.mSeconds * 1000.,
+                              aim.mBest.mBroken);
+          angle = aim.mBest.mAngle;
+          arena.launch(angle);
+        }
+        sClick.reset();
+        sAssist = false;
+        float alpha = 1.f;
+        {
+          view::Profiler::Scope timer(profiler, view::Stage::Step);
+          bool                  wasInPlay = arena.inPlay();
+          double                now       = glfwGetTime();
+          alpha                           = stepper.update(now - time);
+          time                            = now;
+          if (wasInPlay && !arena.inPlay()) {
+            if (recorder) {
+              recorder->write(TurnRecord(arena, turn, angle));
+            }
+            if (arena.advance(++turn)) {
+              view::logger().info("Game over after {} turns.", turn);
+              glfwSetWindowShouldClose(window, GLFW_TRUE);
+            }
+          }
+        }
+        {
+          view::Profiler::Scope timer(profiler, view::Stage::Upload);
+          arena.interpolate(alpha);
+          arena.flush();
+        }
+        {
+          view::Profiler::Scope timer(profiler, view::Stage::Draw);
+          screen.begin();
+          arena.draw();
+        }
+        profiler.draw();
+        screen.end();
         glfwSwapBuffers(window);
+        profiler.endFrame();
       }
     }
     view::logger().info("Closing window...\n");
@@ -93,7 +147,253 @@ static int game()
   return 0;
 }
 
+static int headless(uint32_t           nTurns,
+                    uint32_t           nShots,
+                    const StepConfig&  config,
+                    const std::string& recordPath)
+{
+  view::logger().info("Simulating {} turns without rendering...", nTurns);
+  // With shots, every turn is aimed by the solver instead of at random.
+  std::optional<JobSystem> jobs;
+  std::optional<AimSolver> solver;
+  uint64_t                 totalShots   = 0;
+  double                   solveSeconds = 0.;
+  if (nShots) {
+    jobs.emplace();
+    solver.emplace(*jobs, config);
+  }
+  std::optional<ReplayWriter> recorder;
+  if (!recordPath.empty()) {
+    recorder.emplace(recordPath, 0, config);
+    if (!recorder->good()) {
+      view::logger().error("Cannot record to '{}'.", recordPath);
+      return 1;
+    }
+  }
+  auto     start = std::chrono::steady_clock::now();
+  uint32_t turn  = 0;
+  while (turn < nTurns) {
+    // Play games back to back until enough turns have been simulated. A log only holds
+    // one game, so a recorded run stops at the end of the first one.
+    Simulation sim(config);
+    for (; turn < nTurns; ++turn) {
+      float angle = sim.arena().randomAngle(turn);
+      if (solver) {
+        // The solver aims from the board after the new row, so it runs between the two
+        // halves of the turn.
+        if (sim.arena().advance(turn)) {
+          break;
+        }
+        Aim aim = solver->solve(sim.arena(), nShots, std::chrono::seconds(10), turn);
+        totalShots += aim.mNumShots;
+        solveSeconds += aim.mSeconds;
+        angle = aim.mBest.mAngle;
+        sim.playShot(angle);
+      }
+      else if (!sim.playTurn(turn, angle)) {
+        break;
+      }
+      if (recorder) {
+        recorder->write(TurnRecord(sim.arena(), turn, angle));
+      }
+    }
+    if (recorder) {
+      nTurns = turn;
+    }
+  }
+  double seconds =
+    std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  view::logger().info("Simulated {} turns in {:.3f}s ({:.1f} turns/s).",
+                      nTurns,
+                      seconds,
+                      double(nTurns) / seconds);
+  if (solver) {
+    view::logger().info("Solver played {} shots in {:.3f}s ({:.1f} shots/s per core).",
+                        totalShots,
+                        solveSeconds,
+                        double(totalShots) / solveSeconds / jobs->numWorkers());
+  }
+  return 0;
+}
+
+static int headlessParallel(uint32_t nTurns, uint32_t nWorlds, const StepConfig& config)
+{
+  JobSystem jobs;
+  view::logger().info("Simulating {} turns in each of {} worlds on {} threads...",
+                      nTurns,
+                      nWorlds,
+                      jobs.numWorkers());
+  auto      start = std::chrono::steady_clock::now();
+  WorldPool pool(jobs, nWorlds, config);
+  for (uint32_t turn = 0; turn < nTurns; ++turn) {
+    pool.playTurn();
+  }
+  double seconds =
+    std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  double total = double(nTurns) * double(nWorlds);
+  view::logger().info(
+    "Simulated {} turns in {:.3f}s ({:.1f} turns/s).", total, seconds, total / seconds);
+  pool.logStats();
+  return 0;
+}
+
+// Parses all of `val` as a number. Leaves `out` alone and returns false if it isn't one.
+template<typename T>
+static bool parseNumber(std::string_view val, T& out)
+{
+  T    parsed;
+  auto end        = val.data() + val.size();
+  auto [ptr, err] = std::from_chars(val.data(), end, parsed);
+  if (err != std::errc() || ptr != end) {
+    return false;
+  }
+  out = parsed;
+  return true;
+}
+
+static std::string_view pipelineName(view::Pipeline pipeline)
+{
+  switch (pipeline) {
+  case view::Pipeline::Geometry:
+    return "geometry";
+  case view::Pipeline::Instanced:
+    return "instanced";
+  }
+  return "unknown";
+}
+
+static std::string_view fontName(view::Font font)
+{
+  switch (font) {
+  case view::Font::Bitmap:
+    return "bitmap";
+  case view::Font::Sdf:
+    return "sdf";
+  }
+  return "unknown";
+}
+
+static std::string_view physicsName(Physics physics)
+{
+  switch (physics) {
+  case Physics::Box2D:
+    return "box2d";
+  case Physics::Grid:
+    return "grid";
+  }
+  return "unknown";
+}
+
 int main(int argc, char** argv)
 {
-  return game();
+  bool           runHeadless = false;
+  bool           showStats   = false;
+  uint32_t       nTurns      = 1000;
+  uint32_t       nWorlds     = 1;
+  uint32_t       nShots      = 0;
+  view::Pipeline pipeline    = view::Pipeline::Geometry;
+  view::Font     font        = view::Font::Sdf;
+  float          renderScale = 1.f;
+  StepConfig     config;
+  std::string    recordPath;
+  std::string    replayPath;
+  std::string    tracePath;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (arg == "--headless") {
+      runHeadless = true;
+    }
+    else if (arg == "--turns" && i + 1 < argc) {
+      std::string_view val = argv[++i];
+      if (!parseNumber(val, nTurns)) {
+        view::logger().error("Invalid number of turns '{}'.", val);
+        return 1;
+      }
+    }
+    else if (arg == "--worlds" && i + 1 < argc) {
+      std::string_view val = argv[++i];
+      if (!parseNumber(val, nWorlds)) {
+        view::logger().error("Invalid number of worlds '{}'.", val);
+        return 1;
+      }
+    }
+    else if (arg == "--shots" && i + 1 < argc) {
+      std::string_view val = argv[++i];
+      if (!parseNumber(val, nShots)) {
+        view::logger().error("Invalid number of shots '{}'.", val);
+        return 1;
+      }
+    }
+    else if (arg == "--pipeline" && i + 1 < argc) {
+      std::string_view val = argv[++i];
+      if (val == pipelineName(view::Pipeline::Instanced)) {
+        pipeline = view::Pipeline::Instanced;
+      }
+      else if (val != pipelineName(view::Pipeline::Geometry)) {
+        view::logger().error("Unknown pipeline '{}'.", val);
+        return 1;
+      }
+    }
+    else if (arg == "--font" && i + 1 < argc) {
+      std::string_view val = argv[++i];
+      if (val == fontName(view::Font::Bitmap)) {
+        font = view::Font::Bitmap;
+      }
+      else if (val != fontName(view::Font::Sdf)) {
+        view::logger().error("Unknown font '{}'.", val);
+        return 1;
+      }
+    }
+    else if (arg == "--render-scale" && i + 1 < argc) {
+      // A fraction of the resolution of the window to draw the arena at.
+      std::string_view val = argv[++i];
+      if (!parseNumber(val, renderScale)) {
+        view::logger().error("Invalid render scale '{}'.", val);
+        return 1;
+      }
+      if (!(renderScale >= 0.1f && renderScale <= 1.f)) {
+        view::logger().error("The render scale must be between 0.1 and 1.");
+        return 1;
+      }
+    }
+    else if (arg == "--record" && i + 1 < argc) {
+      recordPath = argv[++i];
+    }
+    else if (arg == "--trace" && i + 1 < argc) {
+      tracePath = argv[++i];
+    }
+    else if (arg == "--replay" && i + 1 < argc) {
+      replayPath = argv[++i];
+    }
+    else if (arg == "--physics" && i + 1 < argc) {
+      std::string_view val = argv[++i];
+      if (val == physicsName(Physics::Grid)) {
+        config.mPhysics = Physics::Grid;
+      }
+      else if (val != physicsName(Physics::Box2D)) {
+        view::logger().error("Unknown physics '{}'.", val);
+        return 1;
+      }
+    }
+    else if (arg == "--stats") {
+      showStats = true;
+    }
+    else if (arg == "--no-shader-cache") {
+      view::setShaderCacheDir({});
+    }
+    else {
+      view::logger().error("Unknown argument '{}'.", arg);
+      return 1;
+    }
+  }
+  // Written when main returns.
+  trace::Session tracing(tracePath);
+  if (!replayPath.empty()) {
+    return playback(replayPath);
+  }
+  if (runHeadless) {
+    return nWorlds > 1 ? headlessParallel(nTurns, nWorlds, config)
+                       : headless(nTurns, nShots, config, recordPath);
+  }
+  return game(pipeline, font, config.mPhysics, renderScale, recordPath, showStats);
 }
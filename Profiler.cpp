@@ -0,0 +1,220 @@
+#include <Profiler.h>
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+
+namespace view {
+
+std::string_view stageName(Stage stage)
+{
+  switch (stage) {
+  case Stage::Frame:
+    return "frame";
+  case Stage::Step:
+    return "step";
+  case Stage::Upload:
+    return "upload";
+  case Stage::Draw:
+    return "draw";
+  }
+  return "unknown";
+}
+
+void RollingStats::add(float ms)
+{
+  mSamples[mNext] = ms;
+  mNext           = (mNext + 1) % NSamples;
+  mCount          = std::min(mCount + 1, NSamples);
+}
+
+size_t RollingStats::size() const
+{
+  return mCount;
+}
+
+float RollingStats::percentile(float p) const
+{
+  if (!mCount) {
+    return 0.f;
+  }
+  // Nearest rank.
+  size_t rank = size_t(std::ceil(p * float(mCount)));
+  size_t k    = std::clamp<size_t>(rank, 1, mCount) - 1;
+  std::array<float, NSamples> sorted;
+  auto end = std::copy_n(mSamples.begin(), mCount, sorted.begin());
+  std::nth_element(sorted.begin(), sorted.begin() + k, end);
+  return sorted[k];
+}
+
+GpuTimer::~GpuTimer()
+{
+  if (mQueries[0]) {
+    GL_CALL(glDeleteQueries(GLsizei(NQueries), mQueries.data()));
+  }
+}
+
+void GpuTimer::begin()
+{
+  if (!mQueries[0]) {
+    GL_CALL(glGenQueries(GLsizei(NQueries), mQueries.data()));
+  }
+  mActive = mBegun - mCollected < NQueries;
+  if (mActive) {
+    GL_CALL(glBeginQuery(GL_TIME_ELAPSED, mQueries[mBegun % NQueries]));
+  }
+}
+
+void GpuTimer::end()
+{
+  if (mActive) {
+    GL_CALL(glEndQuery(GL_TIME_ELAPSED));
+    ++mBegun;
+    mActive = false;
+  }
+}
+
+void GpuTimer::collect(RollingStats& stats)
+{
+  // Queries finish in the order they were issued.
+  for (; mCollected < mBegun; ++mCollected) {
+    uint32_t query = mQueries[mCollected % NQueries];
+    GLint    ready = 0;
+    GL_CALL(glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &ready));
+    if (!ready) {
+      break;
+    }
+    GLuint64 ns = 0;
+    GL_CALL(glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns));
+    stats.add(float(double(ns) * 1e-6));
+  }
+}
+
+Profiler::Scope::Scope(Profiler& profiler, Stage stage)
+    : mProfiler(profiler)
+    , mStage(stage)
+    , mTrace(stageName(stage).data())
+{
+  if (mProfiler.mEnabled) {
+    mStart = Clock::now();
+    if (onGpu(mStage)) {
+      (*mProfiler.mGpuTimers)[size_t(mStage)].begin();
+    }
+  }
+}
+
+Profiler::Scope::~Scope()
+{
+  if (mProfiler.mEnabled) {
+    if (onGpu(mStage)) {
+      (*mProfiler.mGpuTimers)[size_t(mStage)].end();
+    }
+    std::chrono::duration<float, std::milli> ms = Clock::now() - mStart;
+    mProfiler.mCpu[size_t(mStage)].add(ms.count());
+  }
+}
+
+Profiler::Profiler(bool enabled)
+    : mEnabled(enabled)
+{
+  if (!mEnabled) {
+    return;
+  }
+  mGpuTimers = std::make_unique<GpuTimers>();
+  mOverlay   = std::make_unique<TextBatch>(glm::vec3 {0.9f, 0.9f, 0.9f});
+  mLastFrame = mLastLog = mLastOverlay = Clock::now();
+  logger().info("Overlay rows: frame, step, upload, draw, gpu upload, gpu draw. Columns: "
+                "p50, p95, p99 in microseconds.");
+}
+
+Profiler::~Profiler() = default;
+
+bool Profiler::enabled() const
+{
+  return mEnabled;
+}
+
+bool Profiler::onGpu(Stage stage)
+{
+  return stage == Stage::Upload || stage == Stage::Draw;
+}
+
+void Profiler::endFrame()
+{
+  if (!mEnabled) {
+    return;
+  }
+  auto                                     now = Clock::now();
+  std::chrono::duration<float, std::milli> ms  = now - mLastFrame;
+  mCpu[size_t(Stage::Frame)].add(ms.count());
+  mLastFrame = now;
+  for (size_t i = 0; i < NStages; ++i) {
+    (*mGpuTimers)[i].collect(mGpu[i]);
+  }
+  if (now - mLastOverlay >= OverlayInterval) {
+    layoutOverlay();
+    mLastOverlay = now;
+  }
+  if (now - mLastLog >= LogInterval) {
+    log();
+    mLastLog = now;
+  }
+}
+
+void Profiler::draw()
+{
+  if (mEnabled) {
+    mOverlay->draw();
+  }
+}
+
+void Profiler::log() const
+{
+  // One line for every stage, as p50/p95/p99 in milliseconds.
+  fmt::memory_buffer buf;
+  auto               out = std::back_inserter(buf);
+  for (size_t i = 0; i < NStages; ++i) {
+    const RollingStats& cpu = mCpu[i];
+    fmt::format_to(out,
+                   "{}{} {:.2f}/{:.2f}/{:.2f}",
+                   i ? ", " : "",
+                   stageName(Stage(i)),
+                   cpu.percentile(0.5f),
+                   cpu.percentile(0.95f),
+                   cpu.percentile(0.99f));
+    if (const RollingStats& gpu = mGpu[i]; gpu.size()) {
+      fmt::format_to(out,
+                     " (gpu {:.2f}/{:.2f}/{:.2f})",
+                     gpu.percentile(0.5f),
+                     gpu.percentile(0.95f),
+                     gpu.percentile(0.99f));
+    }
+  }
+  logger().info("Timings in ms, p50/p95/p99: {}", fmt::to_string(buf));
+}
+
+void Profiler::layoutOverlay()
+{
+  static constexpr float                ColumnWidth = 90.f;
+  static constexpr float                RowHeight   = 28.f;
+  static const glm::vec2                Origin      = {60.f, Arena::Height - 24.f};
+  static constexpr std::array<float, 3> Percentiles = {0.5f, 0.95f, 0.99f};
+  // Every stage on the CPU, then the ones that do work on the GPU.
+  const std::array<const RollingStats*, NStages + 2> rows = {
+    &mCpu[size_t(Stage::Frame)],
+    &mCpu[size_t(Stage::Step)],
+    &mCpu[size_t(Stage::Upload)],
+    &mCpu[size_t(Stage::Draw)],
+    &mGpu[size_t(Stage::Upload)],
+    &mGpu[size_t(Stage::Draw)],
+  };
+  mOverlay->clear();
+  for (size_t r = 0; r < rows.size(); ++r) {
+    for (size_t c = 0; c < Percentiles.size(); ++c) {
+      float     us     = 1000.f * rows[r]->percentile(Percentiles[c]);
+      glm::vec2 offset = {ColumnWidth * float(c), -RowHeight * float(r)};
+      mOverlay->addNumber(uint32_t(std::lround(us)), Origin + offset);
+    }
+  }
+}
+
+}  // namespace view
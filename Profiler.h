@@ -0,0 +1,121 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <memory>
+#include <string_view>
+
+#include <GLUtil.h>
+#include <Trace.h>
+
+namespace view {
+
+// Stages of the main loop that are timed, in the order the overlay lists them.
+enum class Stage
+{
+  Frame,   // From one frame to the next, including the wait on the swap.
+  Step,    // Physics steps and the game logic after them.
+  Upload,  // Blending the balls into the vertices, and uploading the changed ones.
+  Draw,    // Clearing the screen and drawing the arena.
+};
+static constexpr size_t NStages = 4;
+
+// Names are string literals, so they can also name trace events.
+std::string_view stageName(Stage stage);
+
+// The most recent samples of one timing, in milliseconds.
+class RollingStats
+{
+public:
+  static constexpr size_t NSamples = 256;
+
+  void   add(float ms);
+  size_t size() const;
+  // Zero until there are samples. `p` is in [0, 1].
+  float percentile(float p) const;
+
+private:
+  std::array<float, NSamples> mSamples = {};
+  size_t                      mNext    = 0;
+  size_t                      mCount   = 0;
+};
+
+// GL_TIME_ELAPSED queries around a stage. The results are collected frames later, once
+// the GPU has caught up, so the CPU never waits on them. While every query is still in
+// flight, new frames are not timed.
+class GpuTimer
+{
+public:
+  GpuTimer() = default;
+  ~GpuTimer();
+  void begin();
+  void end();
+  // Adds every result that is ready to the stats.
+  void collect(RollingStats& stats);
+  GpuTimer(const GpuTimer&) = delete;
+  GpuTimer(GpuTimer&&)      = delete;
+
+private:
+  static constexpr uint32_t NQueries = 4;
+
+  std::array<uint32_t, NQueries> mQueries   = {};
+  uint32_t                       mBegun     = 0;
+  uint32_t                       mCollected = 0;
+  bool                           mActive    = false;
+};
+
+// Times the stages of the main loop on the CPU, and on the GPU where it does work. The
+// percentiles are drawn over the arena and written to the log every few seconds. A
+// disabled profiler does nothing.
+class Profiler
+{
+public:
+  using Clock = std::chrono::steady_clock;
+
+  // Times a stage for as long as it lives, and traces it if tracing is on.
+  class Scope
+  {
+  public:
+    Scope(Profiler& profiler, Stage stage);
+    ~Scope();
+    Scope(const Scope&) = delete;
+    Scope(Scope&&)      = delete;
+
+  private:
+    Profiler&         mProfiler;
+    Stage             mStage;
+    Clock::time_point mStart;
+    trace::Scope      mTrace;
+  };
+
+  explicit Profiler(bool enabled);
+  ~Profiler();
+  bool enabled() const;
+  // Call once per frame, after the swap.
+  void endFrame();
+  // Draws the overlay. The glyph atlas only has digits, so the rows are the CPU times of
+  // the stages in order, followed by the GPU times of the upload and the draw. The
+  // columns are p50, p95 and p99, in microseconds.
+  void draw();
+
+private:
+  static constexpr auto LogInterval     = std::chrono::seconds(5);
+  static constexpr auto OverlayInterval = std::chrono::milliseconds(500);
+
+  static bool onGpu(Stage stage);
+  void        log() const;
+  void        layoutOverlay();
+
+  using GpuTimers = std::array<GpuTimer, NStages>;
+
+  bool                              mEnabled;
+  std::array<RollingStats, NStages> mCpu;
+  std::array<RollingStats, NStages> mGpu;
+  std::unique_ptr<GpuTimers>        mGpuTimers;
+  std::unique_ptr<TextBatch>        mOverlay;
+  Clock::time_point                 mLastFrame;
+  Clock::time_point                 mLastLog;
+  Clock::time_point                 mLastOverlay;
+};
+
+}  // namespace view
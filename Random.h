@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+#include <array>
+
+namespace rng {
+
+using Counter = std::array<uint32_t, 4>;
+using Key     = std::array<uint32_t, 2>;
+
+// Philox4x32-10 (Salmon et al. 2011). The output is a pure function of the counter and
+// the key. There is no hidden state, so the same inputs give the same numbers on every
+// platform and on any number of threads.
+constexpr Counter philox(Counter ctr, Key key)
+{
+  constexpr uint32_t M0 = 0xD2511F53;
+  constexpr uint32_t M1 = 0xCD9E8D57;
+  constexpr uint32_t W0 = 0x9E3779B9;
+  constexpr uint32_t W1 = 0xBB67AE85;
+  for (int round = 0; round < 10; ++round) {
+    if (round) {
+      key[0] += W0;
+      key[1] += W1;
+    }
+    uint64_t p0 = uint64_t(M0) * ctr[0];
+    uint64_t p1 = uint64_t(M1) * ctr[2];
+    ctr         = {uint32_t(p1 >> 32) ^ ctr[1] ^ key[0],
+                   uint32_t(p1),
+                   uint32_t(p0 >> 32) ^ ctr[3] ^ key[1],
+                   uint32_t(p0)};
+  }
+  return ctr;
+}
+
+// Known answers from the Random123 reference implementation.
+static_assert(philox({0, 0, 0, 0}, {0, 0}) ==
+              Counter {0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8});
+static_assert(philox({0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344},
+                     {0xa4093822, 0x299f31d0}) ==
+              Counter {0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1});
+
+}  // namespace rng
@@ -0,0 +1,136 @@
+#include <GLUtil.h>
+#include <Replay.h>
+#include <chrono>
+#include <type_traits>
+
+// Bumped whenever the layout of the log, or anything that changes how a turn plays out,
+// changes. Old logs can't be replayed bit for bit after that.
+static constexpr uint32_t Magic   = 0x50524243;  // "CBRP"
+static constexpr uint32_t Version = 2;
+
+// Fields are written in host byte order, which is little endian on everything we build
+// for.
+template<typename T>
+static void writePod(std::ofstream& out, const T& val)
+{
+  static_assert(std::is_trivially_copyable_v<T>);
+  out.write(reinterpret_cast<const char*>(&val), sizeof(T));
+}
+
+template<typename T>
+static bool readPod(std::ifstream& in, T& val)
+{
+  static_assert(std::is_trivially_copyable_v<T>);
+  return bool(in.read(reinterpret_cast<char*>(&val), sizeof(T)));
+}
+
+TurnRecord::TurnRecord(const Arena& arena, uint32_t seed, float angle)
+    : mSeed(seed)
+    , mAngle(angle)
+    , mHash(arena.hash())
+    , mBoard(arena.board())
+{}
+
+ReplayWriter::ReplayWriter(const std::string& path,
+                           uint32_t           arenaSeed,
+                           const StepConfig&  config)
+    : mOut(path, std::ios::binary | std::ios::trunc)
+{
+  writePod(mOut, Magic);
+  writePod(mOut, Version);
+  writePod(mOut, arenaSeed);
+  writePod(mOut, config.mHz);
+  writePod(mOut, config.mMaxSubSteps);
+  writePod(mOut, config.mVelocityIterations);
+  writePod(mOut, config.mPositionIterations);
+  writePod(mOut, config.mPhysics);
+  mOut.flush();
+}
+
+bool ReplayWriter::good() const
+{
+  return mOut.good();
+}
+
+void ReplayWriter::write(const TurnRecord& turn)
+{
+  writePod(mOut, turn.mSeed);
+  writePod(mOut, turn.mAngle);
+  writePod(mOut, turn.mHash);
+  writePod(mOut, turn.mBoard);
+  mOut.flush();
+}
+
+ReplayReader::ReplayReader(const std::string& path)
+    : mIn(path, std::ios::binary)
+{
+  uint32_t magic = 0, version = 0;
+  mGood = readPod(mIn, magic) && magic == Magic && readPod(mIn, version) &&
+          version == Version && readPod(mIn, mArenaSeed) && readPod(mIn, mConfig.mHz) &&
+          readPod(mIn, mConfig.mMaxSubSteps) &&
+          readPod(mIn, mConfig.mVelocityIterations) &&
+          readPod(mIn, mConfig.mPositionIterations) && readPod(mIn, mConfig.mPhysics);
+}
+
+bool ReplayReader::good() const
+{
+  return mGood;
+}
+
+uint32_t ReplayReader::arenaSeed() const
+{
+  return mArenaSeed;
+}
+
+const StepConfig& ReplayReader::config() const
+{
+  return mConfig;
+}
+
+bool ReplayReader::next(TurnRecord& turn)
+{
+  return mGood && readPod(mIn, turn.mSeed) && readPod(mIn, turn.mAngle) &&
+         readPod(mIn, turn.mHash) && readPod(mIn, turn.mBoard);
+}
+
+int playback(const std::string& path)
+{
+  ReplayReader reader(path);
+  if (!reader.good()) {
+    view::logger().error("Cannot read a replay from '{}'.", path);
+    return 1;
+  }
+  view::logger().info("Replaying '{}' with arena seed {}...", path, reader.arenaSeed());
+  auto       start = std::chrono::steady_clock::now();
+  Simulation sim(reader.config(), reader.arenaSeed());
+  TurnRecord expected;
+  uint32_t   turn = 0;
+  for (; reader.next(expected); ++turn) {
+    if (!sim.playTurn(expected.mSeed, expected.mAngle)) {
+      view::logger().error("Turn {}: The game ended, but the log goes on.", turn);
+      return 1;
+    }
+    TurnRecord actual(sim.arena(), expected.mSeed, expected.mAngle);
+    if (actual.mHash != expected.mHash) {
+      view::logger().error("Turn {}: Board hash is {:016x}, expected {:016x}.",
+                           turn,
+                           actual.mHash,
+                           expected.mHash);
+      for (uint32_t i = 0; i < Arena::NGrid; ++i) {
+        if (actual.mBoard[i] != expected.mBoard[i]) {
+          view::logger().error("  Cell ({}, {}): {:08x}, expected {:08x}.",
+                               i % Arena::NX,
+                               i / Arena::NX,
+                               actual.mBoard[i],
+                               expected.mBoard[i]);
+        }
+      }
+      return 1;
+    }
+  }
+  double seconds =
+    std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  view::logger().info(
+    "Replayed {} turns in {:.3f}s. Every board matches.", turn, seconds);
+  return 0;
+}
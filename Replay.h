@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+#include <array>
+#include <fstream>
+#include <string>
+
+#include <Game.h>
+
+// One turn of a recorded game: the inputs that drive it, and the board it ended with.
+struct TurnRecord
+{
+  uint32_t                           mSeed  = 0;
+  float                              mAngle = 0.f;
+  uint64_t                           mHash  = 0;
+  std::array<uint32_t, Arena::NGrid> mBoard = {};
+
+  TurnRecord() = default;
+  // The turn that was just played on the arena.
+  TurnRecord(const Arena& arena, uint32_t seed, float angle);
+};
+
+// Writes a game to a binary log. The header holds the arena seed and the step config,
+// followed by one fixed size record per turn. Each turn is flushed as it is written, so
+// a crash still leaves a log of everything up to it. Logs play back bit for bit on the
+// build that wrote them. Other compilers or flags (FMA contraction, for one) can round
+// differently.
+class ReplayWriter
+{
+public:
+  ReplayWriter(const std::string& path, uint32_t arenaSeed, const StepConfig& config);
+  bool good() const;
+  void write(const TurnRecord& turn);
+
+private:
+  std::ofstream mOut;
+};
+
+class ReplayReader
+{
+public:
+  explicit ReplayReader(const std::string& path);
+  bool              good() const;
+  uint32_t          arenaSeed() const;
+  const StepConfig& config() const;
+  // Read the next turn. Returns false at the end of the log.
+  bool next(TurnRecord& turn);
+
+private:
+  std::ifstream mIn;
+  uint32_t      mArenaSeed = 0;
+  StepConfig    mConfig;
+  bool          mGood = false;
+};
+
+// Plays the logged game again without rendering, and checks the board after every turn.
+// Returns non-zero if the log can't be read, or the game diverges from it.
+int playback(const std::string& path);
@@ -0,0 +1,403 @@
+#include <Simd.h>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CABBAGE_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+// MSVC emits AVX2 intrinsics without any flags.
+#define CABBAGE_TARGET_AVX2
+#else
+// Only this function is built for AVX2, the rest of the binary still runs anywhere.
+#define CABBAGE_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define CABBAGE_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace simd {
+
+bool blendPositionsScalar(const float* prevX,
+                          const float* prevY,
+                          const float* curX,
+                          const float* curY,
+                          float        alpha,
+                          Vertex*      dst,
+                          size_t       n)
+{
+  bool moved = false;
+  for (size_t i = 0; i < n; ++i) {
+    float dx = curX[i] - prevX[i];
+    float dy = curY[i] - prevY[i];
+    moved |= (dx != 0.f) | (dy != 0.f);
+    dst[i].mPos = {prevX[i] + alpha * dx, prevY[i] + alpha * dy};
+  }
+  return moved;
+}
+
+static constexpr float BallR   = Arena::BallRadius;
+static constexpr float InvCell = 1.f / Arena::CellSize;
+
+static int cellCoord(float v, uint32_t n)
+{
+  return std::clamp(int(v * InvCell), 0, int(n) - 1);
+}
+
+// Bit `k` of the 64 bit mask split into `lo` and `hi`. Two 32 bit halves and a select,
+// the way the vector kernels do it with per lane 32 bit shifts.
+static uint32_t cellBit(uint32_t lo, uint32_t hi, int k)
+{
+  return ((k < 32 ? lo : hi) >> (k & 31)) & 1;
+}
+
+void moveClearBallsScalar(float*       posX,
+                          float*       posY,
+                          const float* velX,
+                          const float* velY,
+                          float        dt,
+                          uint64_t     cells,
+                          uint8_t*     near,
+                          size_t       n)
+{
+  static constexpr int NX = int(Arena::NX);
+  const uint32_t       lo = uint32_t(cells);
+  const uint32_t       hi = uint32_t(cells >> 32);
+  for (size_t i = 0; i < n; ++i) {
+    float    x0  = posX[i];
+    float    y0  = posY[i];
+    float    x1  = x0 + velX[i] * dt;
+    float    y1  = y0 + velY[i] * dt;
+    float    lx  = std::min(x0, x1) - BallR;
+    float    hx  = std::max(x0, x1) + BallR;
+    float    ly  = std::min(y0, y1) - BallR;
+    float    hy  = std::max(y0, y1) + BallR;
+    int      cx0 = cellCoord(lx, Arena::NX);
+    int      cx1 = cellCoord(hx, Arena::NX);
+    int      cy0 = cellCoord(ly, Arena::NY);
+    int      cy1 = cellCoord(hy, Arena::NY);
+    uint32_t hit = (lx < 0.f) | (hx > Arena::Width) | (hy > Arena::Height) |
+                   (cx1 - cx0 > 1) | (cy1 - cy0 > 1) | cellBit(lo, hi, cy0 * NX + cx0) |
+                   cellBit(lo, hi, cy0 * NX + cx1) | cellBit(lo, hi, cy1 * NX + cx0) |
+                   cellBit(lo, hi, cy1 * NX + cx1);
+    near[i] = uint8_t(hit);
+    posX[i] = hit ? x0 : x1;
+    posY[i] = hit ? y0 : y1;
+  }
+}
+
+#if CABBAGE_X86
+
+static bool hasAVX2()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+  int info[4];
+  __cpuid(info, 1);
+  // The OS has to save the YMM registers too, not just the CPU support them.
+  bool osxsave = (info[2] & (1 << 27)) != 0;
+  if (!osxsave || (_xgetbv(0) & 6) != 6) {
+    return false;
+  }
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+
+CABBAGE_TARGET_AVX2 static bool blendAVX2(const float* prevX,
+                                          const float* prevY,
+                                          const float* curX,
+                                          const float* curY,
+                                          float        alpha,
+                                          Vertex*      dst,
+                                          size_t       n)
+{
+  const __m256 a     = _mm256_set1_ps(alpha);
+  const __m256 zero  = _mm256_setzero_ps();
+  __m256       moved = zero;
+  size_t       i     = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 px = _mm256_loadu_ps(prevX + i);
+    __m256 py = _mm256_loadu_ps(prevY + i);
+    __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(curX + i), px);
+    __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(curY + i), py);
+    moved     = _mm256_or_ps(moved, _mm256_cmp_ps(dx, zero, _CMP_NEQ_UQ));
+    moved     = _mm256_or_ps(moved, _mm256_cmp_ps(dy, zero, _CMP_NEQ_UQ));
+    // Separate multiply and add, so the result matches the scalar kernel exactly.
+    __m256 x = _mm256_add_ps(px, _mm256_mul_ps(a, dx));
+    __m256 y = _mm256_add_ps(py, _mm256_mul_ps(a, dy));
+    // Interleave into xy pairs: lo = 0 1 | 4 5, hi = 2 3 | 6 7.
+    __m256  lo  = _mm256_unpacklo_ps(x, y);
+    __m256  hi  = _mm256_unpackhi_ps(x, y);
+    __m128  lo0 = _mm256_castps256_ps128(lo);
+    __m128  lo1 = _mm256_extractf128_ps(lo, 1);
+    __m128  hi0 = _mm256_castps256_ps128(hi);
+    __m128  hi1 = _mm256_extractf128_ps(hi, 1);
+    Vertex* v   = dst + i;
+    // Vertices are 12 bytes, so each pair goes out with its own 8 byte store.
+    _mm_storel_pi(reinterpret_cast<__m64*>(&v[0].mPos), lo0);
+    _mm_storeh_pi(reinterpret_cast<__m64*>(&v[1].mPos), lo0);
+    _mm_storel_pi(reinterpret_cast<__m64*>(&v[2].mPos), hi0);
+    _mm_storeh_pi(reinterpret_cast<__m64*>(&v[3].mPos), hi0);
+    _mm_storel_pi(reinterpret_cast<__m64*>(&v[4].mPos), lo1);
+    _mm_storeh_pi(reinterpret_cast<__m64*>(&v[5].mPos), lo1);
+    _mm_storel_pi(reinterpret_cast<__m64*>(&v[6].mPos), hi1);
+    _mm_storeh_pi(reinterpret_cast<__m64*>(&v[7].mPos), hi1);
+  }
+  bool tail = blendPositionsScalar(
+    prevX + i, prevY + i, curX + i, curY + i, alpha, dst + i, n - i);
+  return tail || _mm256_movemask_ps(moved) != 0;
+}
+
+CABBAGE_TARGET_AVX2 static inline __m256i cellCoordAVX2(__m256 v, __m256i last)
+{
+  __m256i c = _mm256_cvttps_epi32(_mm256_mul_ps(v, _mm256_set1_ps(InvCell)));
+  return _mm256_max_epi32(_mm256_min_epi32(c, last), _mm256_setzero_si256());
+}
+
+CABBAGE_TARGET_AVX2 static inline __m256i cellBitAVX2(__m256i lo, __m256i hi, __m256i k)
+{
+  __m256i low = _mm256_cmpgt_epi32(_mm256_set1_epi32(32), k);
+  __m256i sel = _mm256_blendv_epi8(hi, lo, low);
+  __m256i bit = _mm256_srlv_epi32(sel, _mm256_and_si256(k, _mm256_set1_epi32(31)));
+  return _mm256_and_si256(bit, _mm256_set1_epi32(1));
+}
+
+CABBAGE_TARGET_AVX2 static void moveClearAVX2(float*       posX,
+                                              float*       posY,
+                                              const float* velX,
+                                              const float* velY,
+                                              float        dt,
+                                              uint64_t     cells,
+                                              uint8_t*     near,
+                                              size_t       n)
+{
+  const __m256  step   = _mm256_set1_ps(dt);
+  const __m256  r      = _mm256_set1_ps(BallR);
+  const __m256  zero   = _mm256_setzero_ps();
+  const __m256  width  = _mm256_set1_ps(Arena::Width);
+  const __m256  height = _mm256_set1_ps(Arena::Height);
+  const __m256i one    = _mm256_set1_epi32(1);
+  const __m256i nx     = _mm256_set1_epi32(int(Arena::NX));
+  const __m256i lastX  = _mm256_set1_epi32(int(Arena::NX) - 1);
+  const __m256i lastY  = _mm256_set1_epi32(int(Arena::NY) - 1);
+  const __m256i lo     = _mm256_set1_epi32(int(uint32_t(cells)));
+  const __m256i hi     = _mm256_set1_epi32(int(uint32_t(cells >> 32)));
+  size_t        i      = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 x0 = _mm256_loadu_ps(posX + i);
+    __m256 y0 = _mm256_loadu_ps(posY + i);
+    // Separate multiply and add, and min and max with the operands in the order
+    // std::min and std::max compare them, so the result matches the scalar kernel.
+    __m256  x1   = _mm256_add_ps(x0, _mm256_mul_ps(_mm256_loadu_ps(velX + i), step));
+    __m256  y1   = _mm256_add_ps(y0, _mm256_mul_ps(_mm256_loadu_ps(velY + i), step));
+    __m256  lx   = _mm256_sub_ps(_mm256_min_ps(x1, x0), r);
+    __m256  hx   = _mm256_add_ps(_mm256_max_ps(x1, x0), r);
+    __m256  ly   = _mm256_sub_ps(_mm256_min_ps(y1, y0), r);
+    __m256  hy   = _mm256_add_ps(_mm256_max_ps(y1, y0), r);
+    __m256i cx0  = cellCoordAVX2(lx, lastX);
+    __m256i cx1  = cellCoordAVX2(hx, lastX);
+    __m256i row0 = _mm256_mullo_epi32(cellCoordAVX2(ly, lastY), nx);
+    __m256i row1 = _mm256_mullo_epi32(cellCoordAVX2(hy, lastY), nx);
+    __m256  out  = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(lx, zero, _CMP_LT_OQ),
+                                             _mm256_cmp_ps(hx, width, _CMP_GT_OQ)),
+                                _mm256_cmp_ps(hy, height, _CMP_GT_OQ));
+    __m256i wide = _mm256_or_si256(_mm256_cmpgt_epi32(_mm256_sub_epi32(cx1, cx0), one),
+                                   _mm256_cmpgt_epi32(_mm256_sub_epi32(row1, row0), nx));
+    __m256i bits =
+      _mm256_or_si256(_mm256_or_si256(cellBitAVX2(lo, hi, _mm256_add_epi32(row0, cx0)),
+                                      cellBitAVX2(lo, hi, _mm256_add_epi32(row0, cx1))),
+                      _mm256_or_si256(cellBitAVX2(lo, hi, _mm256_add_epi32(row1, cx0)),
+                                      cellBitAVX2(lo, hi, _mm256_add_epi32(row1, cx1))));
+    __m256i hit  = _mm256_or_si256(_mm256_castps_si256(out),
+                                   _mm256_or_si256(wide, _mm256_cmpeq_epi32(bits, one)));
+    __m256  keep = _mm256_castsi256_ps(hit);
+    _mm256_storeu_ps(posX + i, _mm256_blendv_ps(x1, x0, keep));
+    _mm256_storeu_ps(posY + i, _mm256_blendv_ps(y1, y0, keep));
+    int mask = _mm256_movemask_ps(keep);
+    for (size_t j = 0; j < 8; ++j) {
+      near[i + j] = uint8_t((mask >> j) & 1);
+    }
+  }
+  moveClearBallsScalar(
+    posX + i, posY + i, velX + i, velY + i, dt, cells, near + i, n - i);
+}
+
+#endif
+
+#if CABBAGE_NEON
+
+static bool blendNEON(const float* prevX,
+                      const float* prevY,
+                      const float* curX,
+                      const float* curY,
+                      float        alpha,
+                      Vertex*      dst,
+                      size_t       n)
+{
+  const float32x4_t a     = vdupq_n_f32(alpha);
+  const float32x4_t zero  = vdupq_n_f32(0.f);
+  uint32x4_t        still = vdupq_n_u32(~0u);
+  size_t            i     = 0;
+  for (; i + 4 <= n; i += 4) {
+    float32x4_t px = vld1q_f32(prevX + i);
+    float32x4_t py = vld1q_f32(prevY + i);
+    float32x4_t dx = vsubq_f32(vld1q_f32(curX + i), px);
+    float32x4_t dy = vsubq_f32(vld1q_f32(curY + i), py);
+    still          = vandq_u32(still, vceqq_f32(dx, zero));
+    still          = vandq_u32(still, vceqq_f32(dy, zero));
+    // Separate multiply and add, so the result matches the scalar kernel exactly.
+    float32x4_t   x  = vaddq_f32(px, vmulq_f32(a, dx));
+    float32x4_t   y  = vaddq_f32(py, vmulq_f32(a, dy));
+    float32x4x2_t xy = vzipq_f32(x, y);
+    Vertex*       v  = dst + i;
+    vst1_f32(&v[0].mPos.x, vget_low_f32(xy.val[0]));
+    vst1_f32(&v[1].mPos.x, vget_high_f32(xy.val[0]));
+    vst1_f32(&v[2].mPos.x, vget_low_f32(xy.val[1]));
+    vst1_f32(&v[3].mPos.x, vget_high_f32(xy.val[1]));
+  }
+  bool tail = blendPositionsScalar(
+    prevX + i, prevY + i, curX + i, curY + i, alpha, dst + i, n - i);
+  return tail || vminvq_u32(still) == 0;
+}
+
+static inline int32x4_t cellCoordNEON(float32x4_t v, int32x4_t last)
+{
+  int32x4_t c = vcvtq_s32_f32(vmulq_f32(v, vdupq_n_f32(InvCell)));
+  return vmaxq_s32(vminq_s32(c, last), vdupq_n_s32(0));
+}
+
+static inline uint32x4_t cellBitNEON(uint32x4_t lo, uint32x4_t hi, int32x4_t k)
+{
+  uint32x4_t sel = vbslq_u32(vcltq_s32(k, vdupq_n_s32(32)), lo, hi);
+  // A negative left shift shifts right.
+  uint32x4_t bit = vshlq_u32(sel, vnegq_s32(vandq_s32(k, vdupq_n_s32(31))));
+  return vandq_u32(bit, vdupq_n_u32(1));
+}
+
+static void moveClearNEON(float*       posX,
+                          float*       posY,
+                          const float* velX,
+                          const float* velY,
+                          float        dt,
+                          uint64_t     cells,
+                          uint8_t*     near,
+                          size_t       n)
+{
+  const float32x4_t step   = vdupq_n_f32(dt);
+  const float32x4_t r      = vdupq_n_f32(BallR);
+  const float32x4_t zero   = vdupq_n_f32(0.f);
+  const float32x4_t width  = vdupq_n_f32(Arena::Width);
+  const float32x4_t height = vdupq_n_f32(Arena::Height);
+  const int32x4_t   one    = vdupq_n_s32(1);
+  const int32x4_t   nx     = vdupq_n_s32(int(Arena::NX));
+  const int32x4_t   lastX  = vdupq_n_s32(int(Arena::NX) - 1);
+  const int32x4_t   lastY  = vdupq_n_s32(int(Arena::NY) - 1);
+  const uint32x4_t  lo     = vdupq_n_u32(uint32_t(cells));
+  const uint32x4_t  hi     = vdupq_n_u32(uint32_t(cells >> 32));
+  size_t            i      = 0;
+  for (; i + 4 <= n; i += 4) {
+    float32x4_t x0 = vld1q_f32(posX + i);
+    float32x4_t y0 = vld1q_f32(posY + i);
+    // Separate multiply and add, so the result matches the scalar kernel exactly.
+    float32x4_t x1   = vaddq_f32(x0, vmulq_f32(vld1q_f32(velX + i), step));
+    float32x4_t y1   = vaddq_f32(y0, vmulq_f32(vld1q_f32(velY + i), step));
+    float32x4_t lx   = vsubq_f32(vminq_f32(x0, x1), r);
+    float32x4_t hx   = vaddq_f32(vmaxq_f32(x0, x1), r);
+    float32x4_t ly   = vsubq_f32(vminq_f32(y0, y1), r);
+    float32x4_t hy   = vaddq_f32(vmaxq_f32(y0, y1), r);
+    int32x4_t   cx0  = cellCoordNEON(lx, lastX);
+    int32x4_t   cx1  = cellCoordNEON(hx, lastX);
+    int32x4_t   row0 = vmulq_s32(cellCoordNEON(ly, lastY), nx);
+    int32x4_t   row1 = vmulq_s32(cellCoordNEON(hy, lastY), nx);
+    uint32x4_t  out  = vorrq_u32(vorrq_u32(vcltq_f32(lx, zero), vcgtq_f32(hx, width)),
+                                 vcgtq_f32(hy, height));
+    uint32x4_t  wide = vorrq_u32(vcgtq_s32(vsubq_s32(cx1, cx0), one),
+                                 vcgtq_s32(vsubq_s32(row1, row0), nx));
+    uint32x4_t  bits = vorrq_u32(vorrq_u32(cellBitNEON(lo, hi, vaddq_s32(row0, cx0)),
+                                           cellBitNEON(lo, hi, vaddq_s32(row0, cx1))),
+                                 vorrq_u32(cellBitNEON(lo, hi, vaddq_s32(row1, cx0)),
+                                           cellBitNEON(lo, hi, vaddq_s32(row1, cx1))));
+    uint32x4_t  hit  = vorrq_u32(out, vorrq_u32(wide, vtstq_u32(bits, bits)));
+    vst1q_f32(posX + i, vbslq_f32(hit, x0, x1));
+    vst1q_f32(posY + i, vbslq_f32(hit, y0, y1));
+    uint32_t flags[4];
+    vst1q_u32(flags, hit);
+    for (size_t j = 0; j < 4; ++j) {
+      near[i + j] = uint8_t(flags[j] & 1);
+    }
+  }
+  moveClearBallsScalar(
+    posX + i, posY + i, velX + i, velY + i, dt, cells, near + i, n - i);
+}
+
+#endif
+
+Isa isa()
+{
+#if CABBAGE_X86
+  static const Isa best = hasAVX2() ? Isa::AVX2 : Isa::Scalar;
+  return best;
+#elif CABBAGE_NEON
+  return Isa::NEON;
+#else
+  return Isa::Scalar;
+#endif
+}
+
+std::string_view isaName(Isa isa)
+{
+  switch (isa) {
+  case Isa::Scalar:
+    return "scalar";
+  case Isa::AVX2:
+    return "avx2";
+  case Isa::NEON:
+    return "neon";
+  }
+  return "unknown";
+}
+
+bool blendPositions(const float* prevX,
+                    const float* prevY,
+                    const float* curX,
+                    const float* curY,
+                    float        alpha,
+                    Vertex*      dst,
+                    size_t       n)
+{
+#if CABBAGE_X86
+  if (isa() == Isa::AVX2) {
+    return blendAVX2(prevX, prevY, curX, curY, alpha, dst, n);
+  }
+#elif CABBAGE_NEON
+  return blendNEON(prevX, prevY, curX, curY, alpha, dst, n);
+#endif
+  return blendPositionsScalar(prevX, prevY, curX, curY, alpha, dst, n);
+}
+
+void moveClearBalls(float*       posX,
+                    float*       posY,
+                    const float* velX,
+                    const float* velY,
+                    float        dt,
+                    uint64_t     cells,
+                    uint8_t*     near,
+                    size_t       n)
+{
+#if CABBAGE_X86
+  if (isa() == Isa::AVX2) {
+    moveClearAVX2(posX, posY, velX, velY, dt, cells, near, n);
+    return;
+  }
+  moveClearBallsScalar(posX, posY, velX, velY, dt, cells, near, n);
+#elif CABBAGE_NEON
+  moveClearNEON(posX, posY, velX, velY, dt, cells, near, n);
+#else
+  moveClearBallsScalar(posX, posY, velX, velY, dt, cells, near, n);
+#endif
+}
+
+}  // namespace simd
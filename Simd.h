@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include <Game.h>
+
+namespace simd {
+
+enum class Isa
+{
+  Scalar,
+  AVX2,
+  NEON,
+};
+
+// The best instruction set this machine supports, checked once at runtime on x86.
+Isa              isa();
+std::string_view isaName(Isa isa);
+
+// Blends `n` ball positions, prev + alpha * (cur - prev), from arrays of components
+// into the positions of consecutive vertices. Returns true if any ball moved between
+// prev and cur. Dispatches to the best kernel for this machine.
+bool blendPositions(const float* prevX,
+                    const float* prevY,
+                    const float* curX,
+                    const float* curY,
+                    float        alpha,
+                    Vertex*      dst,
+                    size_t       n);
+
+// The portable kernel, also used for the tails that don't fill a vector.
+bool blendPositionsScalar(const float* prevX,
+                          const float* prevY,
+                          const float* curX,
+                          const float* curY,
+                          float        alpha,
+                          Vertex*      dst,
+                          size_t       n);
+
+// The broad phase of GridPhysics. Moves each of the first `n` balls by its velocity
+// times `dt` if its swept bounds stay clear of the walls and of the cells set in
+// `cells`, and sets `near` to 1 for the balls it left in place for the sweep. Every
+// kernel gives the same results, bit for bit, so replays don't depend on the machine.
+void moveClearBalls(float*       posX,
+                    float*       posY,
+                    const float* velX,
+                    const float* velY,
+                    float        dt,
+                    uint64_t     cells,
+                    uint8_t*     near,
+                    size_t       n);
+
+// The portable kernel, also used for the tails that don't fill a vector.
+void moveClearBallsScalar(float*       posX,
+                          float*       posY,
+                          const float* velX,
+                          const float* velY,
+                          float        dt,
+                          uint64_t     cells,
+                          uint8_t*     near,
+                          size_t       n);
+
+}  // namespace simd
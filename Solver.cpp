@@ -0,0 +1,105 @@
+#include <Random.h>
+#include <Solver.h>
+#include <Trace.h>
+#include <algorithm>
+#include <numbers>
+
+float ShotResult::score() const
+{
+  // Clearing squares matters more than chipping at them, and every ball collected is
+  // more damage in all the turns that follow.
+  static constexpr float BrokenWeight  = 10.f;
+  static constexpr float CollectWeight = 5.f;
+  return float(mDamage) + BrokenWeight * float(mBroken) +
+         CollectWeight * float(mCollected);
+}
+
+static ShotResult compareBoards(const std::array<uint32_t, Arena::NGrid>& before,
+                                const std::array<uint32_t, Arena::NGrid>& after)
+{
+  ShotResult result;
+  for (uint32_t i = 0; i < Arena::NGrid; ++i) {
+    Vertex b, a;
+    b.mPacked = before[i];
+    a.mPacked = after[i];
+    if (b.type() == SQUARE) {
+      if (a.type() != SQUARE) {
+        ++result.mBroken;
+        result.mDamage += uint32_t(b.data());
+      }
+      else {
+        result.mDamage += uint32_t(b.data() - a.data());
+      }
+    }
+    else if (b.type() == BALL_SPWN && a.type() != BALL_SPWN) {
+      ++result.mCollected;
+    }
+  }
+  return result;
+}
+
+AimSolver::AimSolver(JobSystem& jobs, const StepConfig& config)
+    : mJobs(jobs)
+    , mConfig(config)
+    , mRoot(std::make_unique<Arena::Snapshot>())
+    , mSims(jobs.numWorkers())
+{}
+
+AimSolver::~AimSolver() {}
+
+Aim AimSolver::solve(const Arena& arena, uint32_t nShots, Duration budget, uint32_t seed)
+{
+  using Clock    = std::chrono::steady_clock;
+  auto start     = Clock::now();
+  auto deadline  = start + std::chrono::duration_cast<Clock::duration>(budget);
+  auto rootBoard = arena.board();
+  arena.snapshot(*mRoot);
+  // A few batches per worker, so that stealing can even out shots of different lengths.
+  // The shots of a batch are strided over the range, which keeps the coverage even when
+  // the deadline cuts the batches short.
+  const uint32_t nBatches = std::min(nShots, mJobs.numWorkers() * 4);
+  const float    range    = std::numbers::pi_v<float> - 2.f * Arena::MinAngle;
+  std::vector<ShotResult> best(nBatches);
+  std::vector<uint32_t>   counts(nBatches, 0);
+  for (uint32_t b = 0; b < nBatches; ++b) {
+    mJobs.submit(b, [&, b] {
+      trace::Scope trace("AimSolver batch");
+      auto& sim = mSims[JobSystem::currentWorker()];
+      if (!sim) {
+        sim = std::make_unique<Simulation>(mConfig);
+      }
+      float bestScore = -1.f;
+      for (uint32_t k = b; k < nShots && Clock::now() < deadline; k += nBatches) {
+        // Stratified: one random angle inside each of the nShots slices of the range.
+        uint32_t r     = rng::philox({k, 0, 0, 2}, {seed, 0})[0];
+        float    u     = (float(k) + float(r >> 8) * 0x1p-24f) / float(nShots);
+        float    angle = Arena::MinAngle + u * range;
+        sim->arena().restore(*mRoot);
+        if (!sim->playShot(angle, deadline)) {
+          // Out of time in the middle of the shot. It doesn't count.
+          break;
+        }
+        ShotResult result = compareBoards(rootBoard, sim->arena().board());
+        result.mAngle     = angle;
+        ++counts[b];
+        if (result.score() > bestScore) {
+          bestScore = result.score();
+          best[b]   = result;
+        }
+      }
+    });
+  }
+  mJobs.wait();
+  Aim aim;
+  for (uint32_t b = 0; b < nBatches; ++b) {
+    if (counts[b] && (!aim.mNumShots || best[b].score() > aim.mBest.score())) {
+      aim.mBest = best[b];
+    }
+    aim.mNumShots += counts[b];
+  }
+  if (!aim.mNumShots) {
+    aim.mBest.mAngle = 0.5f * std::numbers::pi_v<float>;
+  }
+  aim.mSeconds = Duration(Clock::now() - start).count();
+  return aim;
+}
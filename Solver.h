@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include <Game.h>
+#include <Jobs.h>
+
+// What one shot did to the board.
+struct ShotResult
+{
+  float    mAngle     = 0.f;
+  uint32_t mBroken    = 0;  // Squares destroyed.
+  uint32_t mDamage    = 0;  // Total mData taken off the squares.
+  uint32_t mCollected = 0;  // Balls picked up.
+
+  float score() const;
+};
+
+struct Aim
+{
+  ShotResult mBest;
+  uint32_t   mNumShots = 0;
+  double     mSeconds  = 0.;
+};
+
+// Picks a launch angle by sampling shots and playing each one to the end in a private
+// headless world. The samples are spread over the job system, and every worker keeps
+// its own world that is restored from a snapshot of the position for each shot.
+//
+// With grid physics the shots play exactly as they would in the live arena, so the
+// chosen shot does what its result says. With Box2D the scores are approximate: a worker
+// world orders its bodies and contacts differently from the live one, so the same shot
+// can end a few bounces apart there, and which worker plays a shot isn't fixed either.
+class AimSolver
+{
+public:
+  using Duration = std::chrono::duration<double>;
+
+  explicit AimSolver(JobSystem& jobs, const StepConfig& config = {});
+  ~AimSolver();
+  // Samples up to `nShots` angles, stratified over the whole range. Workers stop once
+  // `budget` has passed, dropping the shots they are in the middle of, so the answer
+  // comes back within the budget plus a step.
+  Aim solve(const Arena& arena, uint32_t nShots, Duration budget, uint32_t seed = 0);
+
+private:
+  JobSystem&                               mJobs;
+  StepConfig                               mConfig;
+  std::unique_ptr<Arena::Snapshot>         mRoot;
+  std::vector<std::unique_ptr<Simulation>> mSims;  // One per worker.
+};
@@ -0,0 +1,159 @@
+#include <GLUtil.h>
+#include <Trace.h>
+#include <array>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace trace {
+
+struct Event
+{
+  const char* mName;
+  int64_t     mStart;  // Nanoseconds since the session started.
+  int64_t     mDuration;
+};
+
+// Events are stored in fixed size chunks that never move, so the session can read
+// everything a thread published without stopping it. The owning thread is the only
+// writer, and publishes each event by bumping the count.
+struct ThreadBuffer
+{
+  static constexpr size_t ChunkSize = 4096;
+  static constexpr size_t NChunks   = 256;
+  using Chunk                       = std::array<Event, ChunkSize>;
+
+  std::array<std::unique_ptr<Chunk>, NChunks> mChunks;
+  std::atomic<size_t>                         mCount   = 0;
+  size_t                                      mDropped = 0;  // Once every chunk is full.
+  uint32_t                                    mTid     = 0;
+  std::string                                 mName;
+};
+
+static std::atomic<bool>                          sEnabled = false;
+static Clock::time_point                          sEpoch;
+static std::mutex                                 sMutex;  // Only to register threads.
+static std::vector<std::unique_ptr<ThreadBuffer>> sBuffers;
+static thread_local ThreadBuffer*                 sBuffer = nullptr;
+static thread_local std::string                   sThreadName;
+
+static ThreadBuffer& threadBuffer()
+{
+  if (!sBuffer) {
+    auto buf   = std::make_unique<ThreadBuffer>();
+    buf->mName = sThreadName;
+    std::lock_guard<std::mutex> lock(sMutex);
+    buf->mTid = uint32_t(sBuffers.size());
+    if (buf->mName.empty()) {
+      buf->mName = fmt::format("thread {}", buf->mTid);
+    }
+    sBuffer = buf.get();
+    sBuffers.push_back(std::move(buf));
+  }
+  return *sBuffer;
+}
+
+static void record(const char* name, Clock::time_point start, Clock::time_point end)
+{
+  ThreadBuffer& buf = threadBuffer();
+  size_t        i   = buf.mCount.load(std::memory_order_relaxed);
+  if (i == ThreadBuffer::ChunkSize * ThreadBuffer::NChunks) {
+    ++buf.mDropped;
+    return;
+  }
+  auto& chunk = buf.mChunks[i / ThreadBuffer::ChunkSize];
+  if (!chunk) {
+    chunk = std::make_unique<ThreadBuffer::Chunk>();
+  }
+  (*chunk)[i % ThreadBuffer::ChunkSize] = {
+    name,
+    std::chrono::duration_cast<std::chrono::nanoseconds>(start - sEpoch).count(),
+    std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()};
+  buf.mCount.store(i + 1, std::memory_order_release);
+}
+
+bool enabled()
+{
+  return sEnabled.load(std::memory_order_relaxed);
+}
+
+void nameThread(std::string name)
+{
+  sThreadName = std::move(name);
+}
+
+Scope::Scope(const char* name)
+    : mName(enabled() ? name : nullptr)
+{
+  if (mName) {
+    mStart = Clock::now();
+  }
+}
+
+Scope::~Scope()
+{
+  if (mName) {
+    record(mName, mStart, Clock::now());
+  }
+}
+
+Session::Session(std::string path)
+    : mPath(std::move(path))
+{
+  if (mPath.empty()) {
+    return;
+  }
+  nameThread("main");
+  sEpoch = Clock::now();
+  sEnabled.store(true, std::memory_order_relaxed);
+  view::logger().info("Tracing to '{}'.", mPath);
+}
+
+Session::~Session()
+{
+  if (mPath.empty()) {
+    return;
+  }
+  sEnabled.store(false, std::memory_order_relaxed);
+  std::ofstream out(mPath);
+  if (!out) {
+    view::logger().error("Cannot write the trace to '{}'.", mPath);
+    return;
+  }
+  auto   it      = std::ostreambuf_iterator<char>(out);
+  size_t nEvents = 0;
+  fmt::format_to(it, "{{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  std::lock_guard<std::mutex> lock(sMutex);
+  for (const auto& buf : sBuffers) {
+    fmt::format_to(it,
+                   "{}\n{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":{},"
+                   "\"args\":{{\"name\":\"{}\"}}}}",
+                   nEvents++ ? "," : "",
+                   buf->mTid,
+                   buf->mName);
+    size_t n = buf->mCount.load(std::memory_order_acquire);
+    for (size_t i = 0; i < n; ++i) {
+      const auto&  chunk = *buf->mChunks[i / ThreadBuffer::ChunkSize];
+      const Event& e     = chunk[i % ThreadBuffer::ChunkSize];
+      // Timestamps are in microseconds.
+      fmt::format_to(it,
+                     ",\n{{\"name\":\"{}\",\"ph\":\"X\",\"pid\":1,\"tid\":{},"
+                     "\"ts\":{:.3f},\"dur\":{:.3f}}}",
+                     e.mName,
+                     buf->mTid,
+                     double(e.mStart) * 1e-3,
+                     double(e.mDuration) * 1e-3);
+    }
+    nEvents += n;
+    if (buf->mDropped) {
+      view::logger().warn(
+        "The trace is missing {} events from '{}'.", buf->mDropped, buf->mName);
+    }
+  }
+  fmt::format_to(it, "\n]}}\n");
+  view::logger().info("Wrote {} trace events to '{}'.", nEvents, mPath);
+}
+
+}  // namespace trace
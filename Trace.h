@@ -0,0 +1,48 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+
+// Scoped events written to a Chrome trace (Trace Event JSON), which chrome://tracing and
+// ui.perfetto.dev both open. Each thread records into its own buffer that only it writes
+// to, so recording takes no locks, and costs next to nothing while tracing is off.
+namespace trace {
+
+using Clock = std::chrono::steady_clock;
+
+bool enabled();
+
+// Names the calling thread in the trace. Call it before the thread records anything.
+void nameThread(std::string name);
+
+// Records an event from construction to destruction. The name must outlive the session,
+// a string literal is best.
+class Scope
+{
+public:
+  explicit Scope(const char* name);
+  ~Scope();
+  Scope(const Scope&) = delete;
+  Scope(Scope&&)      = delete;
+
+private:
+  const char*       mName;
+  Clock::time_point mStart;
+};
+
+// Traces everything from construction to destruction into the file, if the path isn't
+// empty. There can only be one session in the lifetime of the process. Construct it on
+// the main thread, and destroy it once the other threads have stopped recording.
+class Session
+{
+public:
+  explicit Session(std::string path);
+  ~Session();
+  Session(const Session&) = delete;
+  Session(Session&&)      = delete;
+
+private:
+  std::string mPath;
+};
+
+}  // namespace trace